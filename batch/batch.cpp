@@ -0,0 +1,323 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "emu.hpp"
+#include "rom_pack.hpp"
+#include "rom_catalog.hpp"
+#include "scheduler.hpp"
+
+// runs a list of roms headlessly, spread over every core, and prints a line per run for regression testing.
+// frames tick the timers and then run instructions_per_frame instructions.
+void print_usage() {
+    printf("usage: chip8-batch [options] <rom, directory or .ch8pack>...\n"
+           "  --list <file>     read more rom paths from a file, one per line\n"
+           "  --cycles <n>      run n instructions per rom\n"
+           "  --frames <n>      run n frames per rom (default 600)\n"
+           "  --ipf <n>         instructions per frame (default 11, the gui's 700 per second)\n"
+           "  --all-quirks      run every combination of quirk options for each rom\n"
+           "  --jit             use the jit engine\n"
+           "  --seed <n>        seed for CXNN (default 1)\n"
+           "  --threads <n>     worker threads (default is one per core)\n"
+           "  --json            print json instead of csv\n");
+}
+
+// a rom file, or a rom in one of the packs, which loads straight out of the pack's mapping
+struct Rom {
+    std::string name;
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+};
+
+struct Job {
+    Rom rom;
+    EmuOptions options;
+};
+
+struct Result {
+    bool loaded = false;
+    uint64_t framebuffer_hash = 0;
+    uint64_t instructions = 0;
+    uint64_t unimplemented_opcodes = 0;
+    double wall_time = 0.0;
+};
+
+struct Settings {
+    uint64_t cycles = 0;
+    uint64_t frames = 600;
+    uint64_t instructions_per_frame = default_instructions_per_second / Scheduler::ticks_per_second;
+    uint32_t seed = 1;
+};
+
+// FNV-1a over the active resolution, so lores hashes don't depend on the hires half of the framebuffer
+uint64_t hash_framebuffer(const EmulatorState& state) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for(int y = 0; y < state.height(); y++) {
+        for(int word = 0; word < state.width() / 64; word++) {
+            for(int byte = 7; byte >= 0; byte--) {
+                hash ^= (state.framebuffer[y][word] >> (byte * 8)) & 0xFF;
+                hash *= 0x100000001b3;
+            }
+        }
+    }
+    
+    return hash;
+}
+
+Result run_job(const Job& job, const Settings& settings) {
+    Result result;
+    
+    const auto start = std::chrono::steady_clock::now();
+    
+    Machine machine;
+    machine.options = job.options;
+    machine.seed = settings.seed;
+    
+    if(job.rom.data != nullptr)
+        result.loaded = machine.load_rom(job.rom.data, job.rom.size);
+    else
+        result.loaded = machine.load_rom(job.rom.name.c_str());
+    
+    if(!result.loaded)
+        return result;
+    
+    if(settings.cycles > 0) {
+        machine.run(settings.cycles);
+        result.instructions = settings.cycles;
+    } else {
+        for(uint64_t frame = 0; frame < settings.frames; frame++) {
+            machine.tick_timers();
+            
+            machine.run(settings.instructions_per_frame);
+        }
+        
+        result.instructions = settings.frames * settings.instructions_per_frame;
+    }
+    
+    const auto end = std::chrono::steady_clock::now();
+    
+    result.framebuffer_hash = hash_framebuffer(machine.state);
+    result.unimplemented_opcodes = machine.unimplemented_opcodes;
+    result.wall_time = std::chrono::duration<double>(end - start).count();
+    
+    return result;
+}
+
+// packs stay open until the end, their roms point into them
+bool add_rom_path(std::vector<Rom>& roms, std::vector<std::unique_ptr<RomPack>>& packs, const std::string& path) {
+    if(std::filesystem::path(path).extension() == rom_pack_extension) {
+        auto pack = std::make_unique<RomPack>();
+        if(!pack->open(path.c_str())) {
+            fprintf(stderr, "couldn't open pack %s\n", path.c_str());
+            return false;
+        }
+        
+        for(size_t i = 0; i < pack->size(); i++) {
+            const PackEntry entry = pack->entry(i);
+            roms.push_back({path + "/" + std::string(entry.name), entry.data, entry.size});
+        }
+        
+        packs.push_back(std::move(pack));
+        return true;
+    }
+    
+    if(!std::filesystem::is_directory(path)) {
+        roms.push_back({path});
+        return true;
+    }
+    
+    std::vector<std::string> directory_roms;
+    for(auto& p : std::filesystem::directory_iterator(path)) {
+        if(p.is_regular_file() && p.path().filename() != RomCatalog::index_name)
+            directory_roms.push_back(p.path());
+    }
+    
+    std::sort(directory_roms.begin(), directory_roms.end());
+    
+    bool added = true;
+    for(auto& rom : directory_roms) {
+        if(std::filesystem::path(rom).extension() == rom_pack_extension)
+            added &= add_rom_path(roms, packs, rom);
+        else
+            roms.push_back({rom});
+    }
+    
+    return added;
+}
+
+std::string quirks_string(const EmuOptions& options) {
+    std::string quirks;
+    if(options.emulate_original)
+        quirks += "original";
+    
+    if(options.enable_anti_flicker)
+        quirks += quirks.empty() ? "anti-flicker" : "+anti-flicker";
+    
+    return quirks.empty() ? "none" : quirks;
+}
+
+// rom paths are the only free-form strings, csv doubles quotes and json escapes them along with control characters
+std::string quoted(const std::string& string, const bool json) {
+    std::string escaped = "\"";
+    for(const char c : string) {
+        if(json && (unsigned char)c < 0x20) {
+            if(c == '\n') {
+                escaped += "\\n";
+            } else if(c == '\t') {
+                escaped += "\\t";
+            } else {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+                escaped += code;
+            }
+            
+            continue;
+        }
+        
+        if(c == '"')
+            escaped += json ? '\\' : '"';
+        else if(c == '\\' && json)
+            escaped += '\\';
+        
+        escaped += c;
+    }
+    
+    return escaped + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<Rom> roms;
+    std::vector<std::unique_ptr<RomPack>> packs;
+    Settings settings;
+    bool all_quirks = false, json = false;
+    Engine engine = Engine::Interpreter;
+    unsigned int thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    
+    for(int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        
+        if(!strcmp(argv[i], "--cycles") && has_value) {
+            settings.cycles = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--frames") && has_value) {
+            settings.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--ipf") && has_value) {
+            settings.instructions_per_frame = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--seed") && has_value) {
+            settings.seed = std::max<uint32_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+        } else if(!strcmp(argv[i], "--threads") && has_value) {
+            thread_count = std::max<unsigned int>(std::strtoul(argv[++i], nullptr, 10), 1);
+        } else if(!strcmp(argv[i], "--list") && has_value) {
+            std::ifstream list(argv[++i]);
+            if(!list) {
+                fprintf(stderr, "couldn't open %s\n", argv[i]);
+                return 1;
+            }
+            
+            std::string line;
+            while(std::getline(list, line)) {
+                if(!line.empty() && !add_rom_path(roms, packs, line))
+                    return 1;
+            }
+        } else if(!strcmp(argv[i], "--all-quirks")) {
+            all_quirks = true;
+        } else if(!strcmp(argv[i], "--jit")) {
+            engine = Engine::JIT;
+        } else if(!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if(argv[i][0] == '-') {
+            print_usage();
+            return 1;
+        } else if(!add_rom_path(roms, packs, argv[i])) {
+            return 1;
+        }
+    }
+    
+    if(roms.empty()) {
+        print_usage();
+        return 1;
+    }
+    
+    std::vector<Job> jobs;
+    for(auto& rom : roms) {
+        EmuOptions options;
+        options.engine = engine;
+        
+        if(!all_quirks) {
+            jobs.push_back({rom, options});
+            continue;
+        }
+        
+        for(const bool emulate_original : {false, true}) {
+            for(const bool enable_anti_flicker : {false, true}) {
+                options.emulate_original = emulate_original;
+                options.enable_anti_flicker = enable_anti_flicker;
+                
+                jobs.push_back({rom, options});
+            }
+        }
+    }
+    
+    // workers pull the next job off a shared counter, results keep the job order
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> next_job = 0;
+    
+    std::vector<std::thread> workers;
+    for(unsigned int i = 0; i < std::min<size_t>(thread_count, jobs.size()); i++) {
+        workers.emplace_back([&] {
+            for(size_t job = next_job++; job < jobs.size(); job = next_job++)
+                results[job] = run_job(jobs[job], settings);
+        });
+    }
+    
+    for(auto& worker : workers)
+        worker.join();
+    
+    if(json)
+        printf("[\n");
+    else
+        printf("rom,quirks,loaded,framebuffer_hash,instructions,unimplemented,wall_time\n");
+    
+    for(size_t i = 0; i < jobs.size(); i++) {
+        const Job& job = jobs[i];
+        const Result& result = results[i];
+        
+        if(json) {
+            printf("  {\"rom\": %s, \"quirks\": \"%s\", \"loaded\": %s, \"framebuffer_hash\": \"%016llx\", \"instructions\": %llu, \"unimplemented\": %llu, \"wall_time\": %.6f}%s\n",
+                   quoted(job.rom.name, true).c_str(),
+                   quirks_string(job.options).c_str(),
+                   result.loaded ? "true" : "false",
+                   (unsigned long long)result.framebuffer_hash,
+                   (unsigned long long)result.instructions,
+                   (unsigned long long)result.unimplemented_opcodes,
+                   result.wall_time,
+                   i + 1 < jobs.size() ? "," : "");
+        } else {
+            printf("%s,%s,%d,%016llx,%llu,%llu,%.6f\n",
+                   quoted(job.rom.name, false).c_str(),
+                   quirks_string(job.options).c_str(),
+                   result.loaded,
+                   (unsigned long long)result.framebuffer_hash,
+                   (unsigned long long)result.instructions,
+                   (unsigned long long)result.unimplemented_opcodes,
+                   result.wall_time);
+        }
+    }
+    
+    if(json)
+        printf("]\n");
+    
+    bool all_loaded = std::all_of(results.begin(), results.end(), [](const Result& result) {
+        return result.loaded;
+    });
+    
+    return all_loaded ? 0 : 1;
+}
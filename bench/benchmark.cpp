@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "emu.hpp"
+#include "rom_catalog.hpp"
+#include "rom_pack.hpp"
+
+#ifdef CHIP8_LOCKSTEP
+#include "lockstep.hpp"
+#endif
+
+// measures process_opcode on every fetch and run() for the dispatch backend this was built with, and the jit.
+// build with CHIP8_BENCHMARK_ALL_BACKENDS to get one of these per backend.
+constexpr uint64_t default_instruction_count = 10'000'000;
+
+// lockstep MIPS counts every lane, all of them running the same rom with no input
+constexpr int lockstep_lanes = 64;
+
+template<typename F>
+double measure_mips(const std::string& rom, const uint64_t count, F execute) {
+    Machine machine;
+    machine.load_rom(rom.c_str());
+    
+    const auto start = std::chrono::steady_clock::now();
+    execute(machine, count);
+    const auto end = std::chrono::steady_clock::now();
+    
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    
+    return (count / seconds) / 1'000'000.0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* rom_directory = argc > 1 ? argv[1] : "roms/";
+    const uint64_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : default_instruction_count;
+    
+    std::vector<std::string> rom_paths;
+    for(auto& p : std::filesystem::directory_iterator(rom_directory)) {
+        // the gui's catalog keeps its index next to the roms, and packs aren't roms themselves
+        if(p.path().filename() != RomCatalog::index_name && p.path().extension() != rom_pack_extension)
+            rom_paths.push_back(p.path());
+    }
+    
+    std::sort(rom_paths.begin(), rom_paths.end());
+    
+    printf("dispatch backend: %s\n", dispatch_backend);
+#ifdef CHIP8_LOCKSTEP
+    printf("lockstep: %s, %d lanes\n", lockstep_isa, lockstep_lanes);
+#endif
+    printf("%-24s %12s %12s %8s", "rom", "opcode MIPS", "run MIPS", "speedup");
+#ifdef CHIP8_JIT
+    printf(" %12s %8s", "jit MIPS", "speedup");
+#endif
+#ifdef CHIP8_LOCKSTEP
+    printf(" %14s %8s", "lockstep MIPS", "speedup");
+#endif
+    printf("\n");
+    
+    for(auto& rom : rom_paths) {
+        const double opcode_mips = measure_mips(rom, count, [](Machine& machine, const uint64_t count) {
+            for(uint64_t i = 0; i < count; i++)
+                machine.process_opcode(machine.fetch_opcode(machine.state.PC));
+        });
+        
+        const double run_mips = measure_mips(rom, count, [](Machine& machine, const uint64_t count) {
+            machine.run(count);
+        });
+        
+        const auto name = std::filesystem::path(rom).filename().string();
+        printf("%-24s %12.1f %12.1f %7.2fx", name.c_str(), opcode_mips, run_mips, run_mips / opcode_mips);
+
+#ifdef CHIP8_JIT
+        const double jit_mips = measure_mips(rom, count, [](Machine& machine, const uint64_t count) {
+            machine.options.engine = Engine::JIT;
+            machine.run(count);
+        });
+        
+        printf(" %12.1f %7.2fx", jit_mips, jit_mips / opcode_mips);
+#endif
+#ifdef CHIP8_LOCKSTEP
+        Lockstep lockstep(lockstep_lanes);
+        lockstep.load_rom(rom.c_str());
+        
+        const auto start = std::chrono::steady_clock::now();
+        lockstep.run(count / lockstep_lanes);
+        const auto end = std::chrono::steady_clock::now();
+        
+        const double lockstep_mips = (count / std::chrono::duration<double>(end - start).count()) / 1'000'000.0;
+        
+        printf(" %14.1f %7.2fx", lockstep_mips, lockstep_mips / opcode_mips);
+#endif
+        printf("\n");
+    }
+    
+    return 0;
+}
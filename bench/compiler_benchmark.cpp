@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+#include "compiler.hpp"
+
+// compiles a generated program with every kind of statement in it and prints the fastest of a few runs.
+// the program is far too big to fit in memory, so it compiles all the way through and then fails the size check.
+constexpr int default_line_count = 100'000;
+constexpr int runs = 5;
+constexpr int variable_count = 64;
+
+std::string generate_program(const int line_count) {
+    std::string source;
+    source.reserve(line_count * 24);
+    
+    for(int i = 0; i < variable_count; i++)
+        source += "var value" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+    
+    for(int line = variable_count; line < line_count; line++) {
+        const std::string variable = "value" + std::to_string(line % variable_count);
+        const std::string label = "loop" + std::to_string(line / 8);
+        
+        switch(line % 8) {
+            case 0: source += "label(" + label + ");\n"; break;
+            case 1: source += variable + " += 3;\n"; break;
+            case 2: source += "v[1] = " + variable + ";\n"; break;
+            case 3: source += "v[2] += 0x10; // move along\n"; break;
+            case 4: source += "draw_char(v[2], 5, " + variable + ");\n"; break;
+            case 5: source += variable + " = v[1];\n"; break;
+            case 6: source += "v[3] = 200;\n"; break;
+            case 7: source += "jump(" + label + ");\n"; break;
+        }
+    }
+    
+    return source;
+}
+
+int main(int argc, char* argv[]) {
+    const int line_count = argc > 1 ? std::atoi(argv[1]) : default_line_count;
+    
+    const std::string source = generate_program(line_count);
+    
+    double best = 0.0;
+    CompiledProgram program;
+    for(int i = 0; i < runs; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        program = compile(source);
+        const auto end = std::chrono::steady_clock::now();
+        
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        best = i == 0 ? seconds : std::min(best, seconds);
+    }
+    
+    printf("%d lines, %zu bytes of source\n", line_count, source.size());
+    printf("best of %d: %.2f ms, %.1f lines/ms, %.1f MB/s\n", runs, best * 1000.0, line_count / (best * 1000.0), source.size() / best / 1'000'000.0);
+    
+    if(program.error.empty())
+        printf("compiled to %zu bytes\n", program.rom.size());
+    else if(program.error_line > 0)
+        printf("line %d: %s\n", program.error_line, program.error.c_str());
+    else
+        printf("%s\n", program.error.c_str());
+    
+    return 0;
+}
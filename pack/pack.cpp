@@ -0,0 +1,21 @@
+#include <cstdio>
+
+#include "rom_pack.hpp"
+
+// builds a rom pack for chip8-batch and the gui to load roms from without a file per rom
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        printf("usage: chip8-pack <directory> <output%.*s>\n", int(rom_pack_extension.size()), rom_pack_extension.data());
+        return 1;
+    }
+    
+    const int count = build_rom_pack(argv[1], argv[2]);
+    if(count < 0) {
+        fprintf(stderr, "couldn't write %s\n", argv[2]);
+        return 1;
+    }
+    
+    printf("packed %d roms into %s\n", count, argv[2]);
+    
+    return 0;
+}
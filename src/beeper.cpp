@@ -0,0 +1,153 @@
+#include "beeper.hpp"
+#include "emu.hpp"
+
+#include <cstdio>
+#include <algorithm>
+
+Beeper::Beeper(const int sample_rate) : sample_rate(sample_rate) {
+    start_queued = sample_rate / 60;
+    max_queued = sample_rate / 15;
+}
+
+void Beeper::gate(const bool on, const uint64_t sample) {
+    if(on == pending_on)
+        return;
+    
+    flush(sample);
+    pending_on = on;
+}
+
+void Beeper::flush(const uint64_t sample) {
+    if(sample <= pending_start)
+        return;
+    
+    // nothing is rendering when the ring is full, so there's nobody to hear what's dropped
+    if(spans.push({uint32_t(sample - pending_start), pending_on}))
+        written.fetch_add(sample - pending_start, std::memory_order_release);
+    
+    pending_start = sample;
+}
+
+void Beeper::run(Machine& machine, const uint64_t count, const uint64_t begin, const uint64_t end) {
+    if(count == 0)
+        return;
+    
+    const EmulatorState before = machine.state;
+    const uint64_t unimplemented_opcodes = machine.unimplemented_opcodes, sound_timer_writes = machine.sound_timer_writes;
+    
+    machine.run(count);
+    
+    // without an FX18 sound_timer stayed the same throughout, so the gate goes where the first instruction ends
+    if(machine.sound_timer_writes == sound_timer_writes) {
+        gate(machine.state.sound_timer > 0, begin + (end - begin) / count);
+        return;
+    }
+    
+    // otherwise it's run again from before, an instruction at a time. memory written along the way goes back too,
+    // along with anything decoded from it
+    int first = 0, last = 4096;
+    while(first < last && machine.state.memory[first] == before.memory[first])
+        first++;
+    
+    while(last > first && machine.state.memory[last - 1] == before.memory[last - 1])
+        last--;
+    
+    machine.state = before;
+    machine.unimplemented_opcodes = unimplemented_opcodes;
+    machine.sound_timer_writes = sound_timer_writes;
+    
+    if(first < last)
+        machine.invalidate_decode_cache(first, last - first);
+    
+    for(uint64_t i = 0; i < count; i++) {
+        machine.run(1);
+        
+        gate(machine.state.sound_timer > 0, begin + (end - begin) * (i + 1) / count);
+    }
+}
+
+void Beeper::render(int16_t* out, const int count) {
+    const uint64_t available = queued();
+    
+    // build up a little before starting again, otherwise every tick of emulation would be its own short burst
+    if(!playing && available < start_queued + count) {
+        std::fill(out, out + count, 0);
+        return;
+    }
+    
+    playing = true;
+    
+    uint64_t skip = available > max_queued ? available - start_queued : 0;
+    uint64_t consumed = 0;
+    
+    const uint32_t step = (uint64_t(frequency) << 32) / sample_rate;
+    
+    int i = 0;
+    while(i < count) {
+        if(current.samples == 0) {
+            const GateSpan* span = spans.peek();
+            if(span == nullptr) {
+                playing = false;
+                break;
+            }
+            
+            current = *span;
+            spans.pop();
+        }
+        
+        if(skip > 0) {
+            const uint32_t skipped = std::min<uint64_t>(skip, current.samples);
+            current.samples -= skipped;
+            consumed += skipped;
+            skip -= skipped;
+            continue;
+        }
+        
+        const int length = std::min<uint64_t>(count - i, current.samples);
+        for(int j = 0; j < length; j++, phase += step)
+            out[i + j] = current.on ? (phase < 0x80000000 ? volume : -volume) : 0;
+        
+        current.samples -= length;
+        consumed += length;
+        i += length;
+    }
+    
+    std::fill(out + i, out + count, 0);
+    
+    read.fetch_add(consumed, std::memory_order_release);
+}
+
+uint64_t Beeper::queued() const {
+    return written.load(std::memory_order_acquire) - read.load(std::memory_order_acquire);
+}
+
+void write_le(FILE* file, const uint32_t value, const int bytes) {
+    for(int i = 0; i < bytes; i++)
+        fputc((value >> (i * 8)) & 0xFF, file);
+}
+
+bool write_wav(const char* path, const std::vector<int16_t>& samples, const int sample_rate) {
+    FILE* file = fopen(path, "wb");
+    if(file == nullptr)
+        return false;
+    
+    const uint32_t data_size = samples.size() * 2;
+    
+    fputs("RIFF", file);
+    write_le(file, 36 + data_size, 4);
+    fputs("WAVEfmt ", file);
+    write_le(file, 16, 4);
+    write_le(file, 1, 2); // PCM
+    write_le(file, 1, 2); // mono
+    write_le(file, sample_rate, 4);
+    write_le(file, sample_rate * 2, 4);
+    write_le(file, 2, 2);
+    write_le(file, 16, 2);
+    fputs("data", file);
+    write_le(file, data_size, 4);
+    
+    for(const int16_t sample : samples)
+        write_le(file, uint16_t(sample), 2);
+    
+    return fclose(file) == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "spsc_ring.hpp"
+
+struct Machine;
+
+// a stretch of samples where the tone is either on or off
+struct GateSpan {
+    uint32_t samples = 0;
+    bool on = false;
+};
+
+// the chip-8 beeper, a square wave that's on while sound_timer is above zero. the emulation thread writes when the
+// tone turns on and off, placed at the sample of the instruction that did it, and the audio thread turns those gates
+// into samples through a lock-free ring. neither side takes a lock or sees the other's state.
+class Beeper {
+public:
+    explicit Beeper(const int sample_rate);
+    
+    // emulation side. the tone is on or off from sample onwards, samples count up from 0 with emulated time
+    void gate(const bool on, const uint64_t sample);
+    
+    // hands every gate up to sample over to the audio side
+    void flush(const uint64_t sample);
+    
+    // runs count instructions, gating on sound_timer where each one would end if they're spread evenly over the
+    // samples from begin to end. they run in one go unless an FX18 among them could have moved the gate
+    void run(Machine& machine, const uint64_t count, const uint64_t begin, const uint64_t end);
+    
+    // audio side. fills out with the next count samples, silence while too little has been handed over
+    void render(int16_t* out, const int count);
+    
+    // how many samples have been handed over but not rendered yet
+    uint64_t queued() const;
+    
+    const int sample_rate;
+    
+    // audio side settings, set these before it starts rendering
+    int frequency = 440;
+    int16_t volume = 4000;
+    
+    // rendering starts once this much is queued and drops anything queued beyond max_queued, so the delay stays
+    // around start_queued however the emulation and audio clocks drift apart
+    uint64_t start_queued = 0, max_queued = 0;
+
+private:
+    SpscRing<GateSpan, 4096> spans;
+    
+    // total samples handed over and rendered
+    std::atomic<uint64_t> written = 0, read = 0;
+    
+    // emulation side, the gate that's open since pending_start
+    bool pending_on = false;
+    uint64_t pending_start = 0;
+    
+    // audio side
+    GateSpan current;
+    bool playing = false;
+    uint32_t phase = 0;
+};
+
+// 16 bit mono PCM
+bool write_wav(const char* path, const std::vector<int16_t>& samples, const int sample_rate);
@@ -1,308 +1,948 @@
 #include "compiler.hpp"
 
-#include <string>
-#include <iostream>
-#include <cstdlib>
-#include <cstdio>
-#include <vector>
-#include <sstream>
-#include <map>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
 #include <algorithm>
 
 #include "emu.hpp"
 
-void set_bit(uint16_t& opcode, int digit, int value) {
-    uint16_t mask = 0x0000;
-    switch(digit) {
-        case 0:
-            mask = 0xF000;
-            break;
-        case 1:
-            mask = 0x0F00;
-            break;
-        case 2:
-            mask = 0x00F0;
-            break;
-        case 3:
-            mask = 0x000F;
-            break;
+// bump allocator the syntax tree lives in, all of it is freed at once so nodes are never destroyed
+class Arena {
+public:
+    template<typename T>
+    T* make() {
+        static_assert(std::is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+        return new(allocate(sizeof(T), alignof(T))) T();
+    }
+
+private:
+    void* allocate(const size_t size, const size_t alignment) {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if(blocks.empty() || offset + size > block_size) {
+            blocks.push_back(std::unique_ptr<std::byte[]>(new std::byte[block_size]));
+            offset = 0;
+        }
+        
+        used = offset + size;
+        
+        return blocks.back().get() + offset;
     }
     
-    opcode = (opcode & ~mask) | (digit == 3 ? value : (value << (8 / digit)));
+    static constexpr size_t block_size = 64 * 1024;
+    
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    size_t used = 0;
+};
+
+enum class TokenType {
+    Identifier,
+    Number,
+    Equals,
+    PlusEquals,
+    LeftParen,
+    RightParen,
+    LeftBracket,
+    RightBracket,
+    Comma,
+    Semicolon,
+    End,
+    Invalid
+};
+
+struct Token {
+    TokenType type = TokenType::End;
+    
+    // points into the source
+    std::string_view text;
+    int line = 1;
+};
+
+// for error messages
+std::string describe(const Token& token) {
+    return token.type == TokenType::End ? "the end" : "'" + std::string(token.text) + "'";
 }
 
-void set_nn(uint16_t& opcode, int value) {
-    opcode = (opcode & ~0x00FF) | value;
+constexpr bool is_digit(const char c) {
+    return c >= '0' && c <= '9';
 }
 
-void set_nnn(uint16_t& opcode, int value) {
-    opcode = (opcode & ~0x0FFF) | value;
+constexpr bool is_identifier_start(const char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
-enum class RegisterOp {
-    Assign,
-    Add
+// hands out one token at a time, skipping whitespace and // comments. nothing is copied out of the source
+class Lexer {
+public:
+    explicit Lexer(const std::string_view source) : source(source) {}
+    
+    Token next();
+
+private:
+    std::string_view source;
+    size_t position = 0;
+    int line = 1;
 };
 
-std::vector<std::string> split(const std::string& s, const char delimiter) {
-    std::vector<std::string> splits;
+Token Lexer::next() {
+    while(position < source.size()) {
+        const char c = source[position];
+        
+        if(c == '\n') {
+            line++;
+            position++;
+        } else if(c == ' ' || c == '\t' || c == '\r') {
+            position++;
+        } else if(c == '/' && position + 1 < source.size() && source[position + 1] == '/') {
+            while(position < source.size() && source[position] != '\n')
+                position++;
+        } else {
+            break;
+        }
+    }
+    
+    Token token;
+    token.line = line;
+    
+    if(position == source.size())
+        return token;
+    
+    const size_t start = position;
+    const char c = source[position++];
     
-    std::istringstream ss(s);
-    std::string split;
-    while (std::getline(ss, split, delimiter))
-        splits.push_back(split);
+    if(is_identifier_start(c) || is_digit(c)) {
+        // numbers take letters too so 0x hex lexes as one token, the parser checks the digits
+        while(position < source.size() && (is_identifier_start(source[position]) || is_digit(source[position])))
+            position++;
         
-    return splits;
+        token.type = is_digit(c) ? TokenType::Number : TokenType::Identifier;
+    } else if(c == '+' && position < source.size() && source[position] == '=') {
+        position++;
+        token.type = TokenType::PlusEquals;
+    } else {
+        switch(c) {
+            case '=': token.type = TokenType::Equals; break;
+            case '(': token.type = TokenType::LeftParen; break;
+            case ')': token.type = TokenType::RightParen; break;
+            case '[': token.type = TokenType::LeftBracket; break;
+            case ']': token.type = TokenType::RightBracket; break;
+            case ',': token.type = TokenType::Comma; break;
+            case ';': token.type = TokenType::Semicolon; break;
+            default: token.type = TokenType::Invalid; break;
+        }
+    }
+    
+    token.text = source.substr(start, position - start);
+    
+    return token;
 }
 
-std::vector<uint16_t> opcodes;
-int v_offset = 0;
-
-bool is_number(const std::string& str) {
-    return std::find_if(str.begin(), str.end(), [](unsigned char c) { return !std::isdigit(c); }) == str.end();
+// decimal, or hex after 0x. anything past 0xFFFF is clamped there so callers only have to range check
+bool parse_number(const std::string_view text, int& value) {
+    int base = 10;
+    size_t i = 0;
+    if(text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        i = 2;
+    }
+    
+    value = 0;
+    for(; i < text.size(); i++) {
+        const char c = text[i];
+        
+        int digit = 0;
+        if(is_digit(c))
+            digit = c - '0';
+        else if(base == 16 && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if(base == 16 && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+        
+        value = std::min(value * base + digit, 0x10000);
+    }
+    
+    return true;
 }
 
-struct VariableData {
-    int offset = program_begin;
-    int default_value = 0;
+enum class OperandType {
+    Number,
+    Register,
+    Variable
 };
 
-std::map<std::string, VariableData> variable_data;
+struct Operand {
+    OperandType type = OperandType::Number;
+    
+    // the number, or the register index
+    uint8_t value = 0;
+    
+    // variables, and label names passed to label() and jump()
+    std::string_view name;
+    
+    // the next argument of a call
+    Operand* next = nullptr;
+};
 
-enum class VariableType {
-    VRegister,
-    Constant,
-    Variable
+enum class StatementType {
+    Declare,
+    Assign,
+    Add,
+    Call
 };
 
-VariableType determine_Type(std::string str) {
-    str.erase(std::remove(str.begin(), str.end(), ' '), str.end());
+struct Statement {
+    StatementType type = StatementType::Assign;
+    int line = 0;
     
-    if(str.find('v') != std::string::npos) {
-        return VariableType::VRegister;
-    } else if(!is_number(str)) {
-        return VariableType::Variable;
-    } else {
-        return VariableType::Constant;
+    // the function for calls
+    std::string_view name;
+    
+    // assignments and declarations, the target of a declaration is the variable
+    Operand* target = nullptr;
+    Operand* value = nullptr;
+    
+    Operand* arguments = nullptr;
+    int argument_count = 0;
+    
+    Statement* next = nullptr;
+};
+
+// recursive descent over the token stream, every node comes out of the arena
+class Parser {
+public:
+    Parser(const std::string_view source, Arena& arena) : lexer(source), arena(arena) {
+        advance();
     }
-}
+    
+    // the statements in order, stops at the first error
+    bool parse(Statement*& first);
+    
+    std::string error;
+    int error_line = 0;
 
-int parse_v_index(std::string str) {
-    str.erase(std::remove(str.begin(), str.end(), ' '), str.end());
+private:
+    void advance() {
+        current = lexer.next();
+    }
+    
+    bool fail(const std::string& message) {
+        error = message;
+        error_line = current.line;
+        return false;
+    }
+    
+    bool expect(const TokenType type, const char* what);
+    
+    Statement* statement();
+    Statement* call(const std::string_view name, Statement* statement);
+    
+    Operand* operand();
+    
+    // the rest of an operand that started with the identifier name, which was already consumed
+    Operand* named_operand(const std::string_view name);
+    
+    Lexer lexer;
+    Arena& arena;
+    Token current;
+};
+
+bool Parser::expect(const TokenType type, const char* what) {
+    if(current.type != type)
+        return fail(std::string("expected ") + what + " but found " + describe(current));
+    
+    advance();
+    
+    return true;
+}
 
-    if(str.find('v') != std::string::npos) {
-        auto left_side_index = str.substr(str.find('[') + 1, str.length() - 2);
-        return std::stoi(left_side_index);
-    } else if(!is_number(str)) {
-        uint16_t opcode = 0xA000;
-        set_nnn(opcode, variable_data[str].offset);
+bool Parser::parse(Statement*& first) {
+    first = nullptr;
+    
+    Statement** tail = &first;
+    while(current.type != TokenType::End) {
+        Statement* parsed = statement();
+        if(parsed == nullptr)
+            return false;
         
-        opcodes.push_back(opcode);
+        *tail = parsed;
+        tail = &parsed->next;
+    }
+    
+    return true;
+}
+
+Statement* Parser::statement() {
+    Statement* statement = arena.make<Statement>();
+    statement->line = current.line;
+    
+    if(current.type != TokenType::Identifier) {
+        fail("expected a statement but found " + describe(current));
+        return nullptr;
+    }
+    
+    const std::string_view name = current.text;
+    advance();
+    
+    if(name == "var") {
+        if(current.type != TokenType::Identifier) {
+            fail("expected a variable name after var");
+            return nullptr;
+        }
         
-        opcode = 0xF065;
-        set_bit(opcode, 1, v_offset);
+        statement->type = StatementType::Declare;
+        statement->target = arena.make<Operand>();
+        statement->target->type = OperandType::Variable;
+        statement->target->name = current.text;
+        advance();
         
-        opcodes.push_back(opcode);
+        if(!expect(TokenType::Equals, "'='"))
+            return nullptr;
         
-        return v_offset++;
+        statement->value = operand();
+    } else if(current.type == TokenType::LeftParen) {
+        if(call(name, statement) == nullptr)
+            return nullptr;
     } else {
-        uint16_t opcode = 0x6000;
-        set_bit(opcode, 1, v_offset);
-        set_nn(opcode, std::stoi(str));
+        statement->target = named_operand(name);
+        if(statement->target == nullptr)
+            return nullptr;
         
-        opcodes.push_back(opcode);
+        if(statement->target->type == OperandType::Number) {
+            fail("can't assign to a number");
+            return nullptr;
+        }
+        
+        if(current.type == TokenType::PlusEquals)
+            statement->type = StatementType::Add;
+        else if(current.type == TokenType::Equals)
+            statement->type = StatementType::Assign;
+        else {
+            fail("expected '=' or '+=' but found " + describe(current));
+            return nullptr;
+        }
+        
+        advance();
         
-        return v_offset++;
+        statement->value = operand();
     }
+    
+    if(statement->type != StatementType::Call && statement->value == nullptr)
+        return nullptr;
+    
+    if(!expect(TokenType::Semicolon, "';'"))
+        return nullptr;
+    
+    return statement;
 }
 
-std::map<std::string, int> get_arguments(std::vector<std::string> args, std::vector<std::string> arg_format) {
-    struct OrderData {
-        std::string arg, name;
-        int v_offset;
-        VariableType type;
-    };
+Statement* Parser::call(const std::string_view name, Statement* statement) {
+    statement->type = StatementType::Call;
+    statement->name = name;
     
-    std::vector<OrderData> datas;
+    // past the (
+    advance();
     
-    int i = 0;
-    for(auto arg : args) {
-        arg.erase(std::remove(arg.begin(), arg.end(), ' '), arg.end());
-
-        OrderData data = {};
-        data.name = arg_format[i];
-        data.arg = arg;
-        data.v_offset = parse_v_index(arg);
-        data.type = determine_Type(arg);
+    Operand** tail = &statement->arguments;
+    while(current.type != TokenType::RightParen) {
+        if(statement->argument_count > 0 && !expect(TokenType::Comma, "','"))
+            return nullptr;
+        
+        Operand* argument = operand();
+        if(argument == nullptr)
+            return nullptr;
         
-        datas.push_back(data);
-        i++;
+        *tail = argument;
+        tail = &argument->next;
+        statement->argument_count++;
     }
     
-    std::sort(datas.begin(), datas.end(), [](const OrderData& a, const OrderData& b) {
-        return a.type == VariableType::Variable && (a.v_offset > b.v_offset);
-    });
+    advance();
+    
+    return statement;
+}
 
-    std::map<std::string, int> real_args;
-    for(auto data : datas) {
-        real_args[data.name] = parse_v_index(data.arg);
+Operand* Parser::operand() {
+    const Token token = current;
+    advance();
+    
+    if(token.type == TokenType::Identifier)
+        return named_operand(token.text);
+    
+    if(token.type != TokenType::Number) {
+        error = "expected a number, register or variable but found " + describe(token);
+        error_line = token.line;
+        return nullptr;
+    }
+    
+    int value = 0;
+    if(!parse_number(token.text, value)) {
+        error = "'" + std::string(token.text) + "' isn't a number";
+        error_line = token.line;
+        return nullptr;
+    }
+    
+    if(value > 0xFF) {
+        error = std::string(token.text) + " doesn't fit in a byte";
+        error_line = token.line;
+        return nullptr;
     }
     
-    return real_args;
+    Operand* operand = arena.make<Operand>();
+    operand->type = OperandType::Number;
+    operand->value = value;
+    
+    return operand;
 }
 
-void compile(std::string code) {
-    int current_offset = 0;
-    int next_instruction = 0;
+Operand* Parser::named_operand(const std::string_view name) {
+    Operand* operand = arena.make<Operand>();
     
-    std::map<std::string, int> function_map;
-    bool needs_to_store_next_function = false;
-    std::string next_function_to_store;
+    // v[N]
+    if(name == "v" && current.type == TokenType::LeftBracket) {
+        advance();
+        
+        int index = 0;
+        if(current.type != TokenType::Number || !parse_number(current.text, index) || index > 0xF) {
+            fail("expected a register from 0 to 15 but found " + describe(current));
+            return nullptr;
+        }
+        
+        advance();
+        
+        if(!expect(TokenType::RightBracket, "']'"))
+            return nullptr;
+        
+        operand->type = OperandType::Register;
+        operand->value = index;
+        
+        return operand;
+    }
     
-    code.erase(std::remove(code.begin(), code.end(), '\n'), code.end());
+    operand->type = OperandType::Variable;
+    operand->name = name;
+    
+    return operand;
+}
+
+constexpr uint16_t with_x(const uint16_t opcode, const int x) {
+    return opcode | (x << 8);
+}
+
+constexpr uint16_t with_xy(const uint16_t opcode, const int x, const int y) {
+    return opcode | (x << 8) | (y << 4);
+}
+
+// turns the statements into opcodes. addresses of spilled variables and labels are filled in once the code is done,
+// the data section starts right after it
+class CodeGenerator {
+public:
+    bool generate(const Statement* first);
+    
+    std::vector<uint16_t> opcodes;
+    
+    // one byte per spilled variable, their starting values
+    std::vector<uint8_t> data;
+    
+    std::string error;
+    int error_line = 0;
+
+private:
+    bool fail(const Statement& statement, const std::string& message) {
+        error = message;
+        error_line = statement.line;
+        return false;
+    }
+    
+    // checks every name, and finds the statements each variable is used between
+    bool analyse(const Statement* first);
+    bool use(const Statement& statement, const Operand& operand, const int index);
+    
+    // a variable live where a loop jumps back to has to keep its register until the jump
+    void extend_over_loops();
+    
+    // hands out registers by linear scan over the live ranges, returns false if anything had to be spilled
+    bool scan(const uint16_t pool);
+    bool allocate();
+    
+    void statement(const Statement& statement);
+    void assign(const Operand& target, const Operand& value);
+    void add(const Operand& target, const Operand& value);
+    void draw_char(const Statement& statement);
+    
+    // the register an operand is in, numbers and spilled variables are put in the next temporary first
+    int read(const Operand& operand, int& next_temporary);
+    
+    // -1 for spilled variables, which go through scratch_register
+    int home(const Operand& operand) const;
+    
+    // ANNN for a spilled variable, patched once the data section has an address
+    void point_at(const int variable);
+    
+    void load(const int variable);
+    void store(const int variable);
+    
+    void emit(const uint16_t opcode) {
+        opcodes.push_back(opcode);
+    }
+    
+    struct Variable {
+        std::string_view name;
         
-    while(true) {
-        next_instruction = code.find_first_of(';', current_offset + 1);
-        if(next_instruction == -1)
-            break;
+        // first is the declaration, last grows to cover loops it's live across
+        int first = 0, last = 0;
+        uint8_t initial_value = 0;
         
-        auto instruction = code.substr(current_offset == 0 ? current_offset : current_offset + 1, current_offset == 0 ? (next_instruction - current_offset) : (next_instruction - current_offset) - 1);
-                
-        if(needs_to_store_next_function) {
-            int offset = (int)opcodes.size() + variable_data.size() + program_begin;
-            needs_to_store_next_function = false;
-            function_map[next_function_to_store] = offset + 1;
-        }
+        int reg = -1;
+        int data_offset = -1;
+    };
+    
+    struct Label {
+        int statement = 0;
+        size_t opcode = 0;
+    };
+    
+    struct Jump {
+        int statement;
+        size_t opcode;
+        std::string_view label;
+        int line;
+    };
+    
+    struct Fixup {
+        size_t opcode;
+        int variable;
+    };
+    
+    std::vector<Variable> variables;
+    std::unordered_map<std::string_view, int> variable_indices;
+    std::unordered_map<std::string_view, Label> labels;
+    
+    std::vector<Jump> jumps;
+    size_t emitted_jumps = 0;
+    
+    std::vector<Fixup> variable_fixups;
+    
+    // registers the program names itself are never handed out
+    uint16_t named_registers = 0;
+    
+    // reserved for the whole program, the most any statement needs at once
+    int temporaries_needed = 0;
+    std::vector<int> temporaries;
+};
+
+// V0-VE, VF is left for the flags 8XY4 and DXYN write
+constexpr uint16_t allocatable_registers = 0x7FFF;
+
+// spilled variables are loaded and stored through v0, since FX55/FX65 move every register up to X
+constexpr int scratch_register = 0;
+
+bool CodeGenerator::use(const Statement& statement, const Operand& operand, const int index) {
+    if(operand.type == OperandType::Register)
+        named_registers |= 1 << operand.value;
+    
+    if(operand.type != OperandType::Variable)
+        return true;
+    
+    auto variable = variable_indices.find(operand.name);
+    if(variable == variable_indices.end())
+        return fail(statement, "unknown variable '" + std::string(operand.name) + "'");
+    
+    variables[variable->second].last = index;
+    
+    return true;
+}
+
+bool CodeGenerator::analyse(const Statement* first) {
+    int index = 0;
+    for(const Statement* current = first; current != nullptr; current = current->next, index++) {
+        const Statement& statement = *current;
         
-        // assignment
-        if(instruction.find("var") != std::string::npos) {
-            auto var_string = split(instruction, ' ');
-            
-            auto var_name = var_string[1];
-            auto var_default = var_string[3];
-            
-            VariableData data = {};
-            data.default_value = std::stoi(var_default);
-            data.offset = program_begin + variable_data.size();
-            
-            variable_data[var_name] = data;
-            
-            uint16_t opcode = 0xA000;
-            set_nnn(opcode, data.offset);
-            
-            opcodes.push_back(opcode);
-            
-            opcode = 0x7000;
-            set_bit(opcode, 1, 0);
-            set_nn(opcode, data.default_value);
-            
-            opcodes.push_back(opcode);
-            
-            opcode = 0xA000;
-            set_nnn(opcode, data.offset);
-            
-            opcodes.push_back(opcode);
-            
-            opcode = 0xF055;
-            set_bit(opcode, 1, 0);
-            
-            opcodes.push_back(opcode);
-        } else if(instruction.find("+=") != std::string::npos) {
-            auto left_side = instruction.substr(0, instruction.find_first_of(' '));
-            auto right_side = instruction.substr(instruction.find("+=") + 2, instruction.length());
-            
-            int right_side_integer = std::stoi(right_side);
-            
-            auto left_side_type = determine_Type(left_side);
-            auto left_side_integer = parse_v_index(left_side);
-                            
-            // 6XNN
-            uint16_t opcode = 0x7000;
-            set_bit(opcode, 1, left_side_integer);
-            set_nn(opcode, right_side_integer);
-            
-            opcodes.push_back(opcode);
-            
-            // if it is a variable, update it in memory
-            if(left_side_type == VariableType::Variable) {
-                opcode = 0xA000;
-                set_nnn(opcode, variable_data[left_side].offset);
+        switch(statement.type) {
+            case StatementType::Declare:
+            {
+                if(!use(statement, *statement.value, index))
+                    return false;
                 
-                opcodes.push_back(opcode);
+                if(variable_indices.count(statement.target->name) != 0)
+                    return fail(statement, "'" + std::string(statement.target->name) + "' is already declared");
                 
-                opcode = 0xF055;
-                set_bit(opcode, 1, left_side_integer);
+                Variable variable;
+                variable.name = statement.target->name;
+                variable.first = variable.last = index;
+                variable.initial_value = statement.value->type == OperandType::Number ? statement.value->value : 0;
                 
-                opcodes.push_back(opcode);
+                variable_indices[statement.target->name] = variables.size();
+                variables.push_back(variable);
             }
-        } else if(instruction.find('=') != std::string::npos) {
-            auto left_side = instruction.substr(0, instruction.find_first_of(' '));
-            auto right_side = instruction.substr(instruction.find('=') + 2, instruction.length());
-            
-            int right_side_integer = std::stoi(right_side);
-            
-            // this is a v register
-            if(left_side.find('[') != std::string::npos) {
-                auto left_side_integer = parse_v_index(left_side);
-                
-                // 6XNN
-                uint16_t opcode = 0x6000;
-                set_bit(opcode, 1, left_side_integer);
-                set_nn(opcode, right_side_integer);
+                break;
+            case StatementType::Assign:
+            case StatementType::Add:
+            {
+                if(!use(statement, *statement.target, index) || !use(statement, *statement.value, index))
+                    return false;
                 
-                opcodes.push_back(opcode);
+                // adding one spilled variable to another needs somewhere to hold the first
+                if(statement.type == StatementType::Add && statement.target->type == OperandType::Variable && statement.value->type == OperandType::Variable)
+                    temporaries_needed = std::max(temporaries_needed, 1);
             }
-        } else if(instruction.find('(') != std::string::npos) {
-            // function
-            auto function_name = instruction.substr(0, instruction.find_first_of('('));
-            
-            auto arguments_string = instruction.substr(instruction.find_first_of('(') + 1, instruction.length() - instruction.find_first_of('(') - 2);
-            auto arguments = split(arguments_string, ',');
+                break;
+            case StatementType::Call:
+            {
+                if(statement.name == "label" || statement.name == "jump") {
+                    const Operand* label = statement.arguments;
+                    if(statement.argument_count != 1 || label->type != OperandType::Variable)
+                        return fail(statement, std::string(statement.name) + "() takes a label name");
+                    
+                    if(statement.name == "jump")
+                        jumps.push_back({index, 0, label->name, statement.line});
+                    else if(!labels.emplace(label->name, Label{index, 0}).second)
+                        return fail(statement, "label '" + std::string(label->name) + "' is already defined");
+                } else if(statement.name == "draw_char") {
+                    if(statement.argument_count != 3)
+                        return fail(statement, "draw_char() takes x, y and a character");
+                    
+                    int needed = 0;
+                    for(const Operand* argument = statement.arguments; argument != nullptr; argument = argument->next) {
+                        if(!use(statement, *argument, index))
+                            return false;
+                        
+                        if(argument->type != OperandType::Register)
+                            needed++;
+                    }
+                    
+                    temporaries_needed = std::max(temporaries_needed, needed);
+                } else {
+                    return fail(statement, "unknown function '" + std::string(statement.name) + "'");
+                }
+            }
+                break;
+        }
+    }
+    
+    for(auto& jump : jumps) {
+        if(labels.count(jump.label) == 0) {
+            error = "unknown label '" + std::string(jump.label) + "'";
+            error_line = jump.line;
+            return false;
+        }
+    }
+    
+    // jumping over a declaration to code that still uses the variable would read whatever its register or data
+    // byte held, so that's an error like it is in C
+    for(auto& jump : jumps) {
+        const int target = labels[jump.label].statement;
+        if(target <= jump.statement)
+            continue;
+        
+        for(const auto& variable : variables) {
+            if(jump.statement < variable.first && variable.first < target && variable.last >= target) {
+                error = "jump(" + std::string(jump.label) + ") skips the declaration of '" + std::string(variable.name) + "'";
+                error_line = jump.line;
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+void CodeGenerator::extend_over_loops() {
+    // growing one range can carry it into another loop, so this goes until nothing changes
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        
+        for(auto& jump : jumps) {
+            const int target = labels[jump.label].statement;
+            if(target >= jump.statement)
+                continue;
             
-            if(function_name == "draw_char") {
-                auto args = get_arguments(arguments, {"x", "y", "n"});
-                
-                auto x_index = args["x"];
-                auto y_index = args["y"];
-                auto c_index = args["n"];
-                
-                // FX29
-                uint16_t opcode = 0xF029;
-                set_bit(opcode, 1, c_index);
-                
-                opcodes.push_back(opcode);
-                
-                // DXYN
-                opcode = 0xD000;
-                set_bit(opcode, 1, x_index);
-                set_bit(opcode, 2, y_index);
-                set_bit(opcode, 3, 5);
-                opcodes.push_back(opcode);
-            } else if(function_name == "label") {
-                needs_to_store_next_function = true;
-                next_function_to_store = arguments[0];
-            } else if(function_name == "jump") {
-                // 1NNN
-                uint16_t opcode = 0x1000;
-                set_nnn(opcode, function_map[arguments[0]]);
-                                
-                opcodes.push_back(opcode);
+            for(auto& variable : variables) {
+                if(variable.first < target && variable.last >= target && variable.last < jump.statement) {
+                    variable.last = jump.statement;
+                    changed = true;
+                }
             }
         }
+    }
+}
+
+bool CodeGenerator::scan(const uint16_t pool) {
+    uint16_t free = pool;
+    bool spilled = false;
+    
+    // variables are already in order of their first statement
+    std::vector<int> active;
+    for(size_t i = 0; i < variables.size(); i++) {
+        Variable& variable = variables[i];
+        variable.reg = -1;
+        
+        // the ones that ended give their registers back
+        for(size_t j = 0; j < active.size();) {
+            if(variables[active[j]].last < variable.first) {
+                free |= 1 << variables[active[j]].reg;
+                active[j] = active.back();
+                active.pop_back();
+            } else {
+                j++;
+            }
+        }
+        
+        if(free != 0) {
+            for(variable.reg = 0; (free & (1 << variable.reg)) == 0; variable.reg++) {}
+            
+            free &= ~(1 << variable.reg);
+            active.push_back(i);
+            continue;
+        }
+        
+        spilled = true;
+        
+        // whichever stays live the longest gives up its register, it would hold it longest
+        auto longest = std::max_element(active.begin(), active.end(), [&](const int a, const int b) {
+            return variables[a].last < variables[b].last;
+        });
+        
+        if(longest != active.end() && variables[*longest].last > variable.last) {
+            variable.reg = variables[*longest].reg;
+            variables[*longest].reg = -1;
+            *longest = i;
+        }
+    }
+    
+    return !spilled;
+}
+
+bool CodeGenerator::allocate() {
+    uint16_t pool = allocatable_registers & ~named_registers;
+    
+    // temporaries come off the top, and are never the scratch register
+    for(int i = 0; i < temporaries_needed; i++) {
+        int reg = 0xE;
+        while(reg > scratch_register && (pool & (1 << reg)) == 0)
+            reg--;
+        
+        if(reg == scratch_register) {
+            error = "there aren't enough registers left for temporaries";
+            return false;
+        }
         
-        v_offset = 0;
-        current_offset = next_instruction;
+        temporaries.push_back(reg);
+        pool &= ~(1 << reg);
+    }
+    
+    if(!scan(pool)) {
+        if(named_registers & (1 << scratch_register)) {
+            error = "there are too many variables to keep in registers, and v[0] is needed to spill them";
+            return false;
+        }
+        
+        scan(pool & ~(1 << scratch_register));
+    }
+    
+    for(auto& variable : variables) {
+        if(variable.reg < 0) {
+            variable.data_offset = data.size();
+            data.push_back(variable.initial_value);
+        }
+    }
+    
+    return true;
+}
+
+int CodeGenerator::home(const Operand& operand) const {
+    if(operand.type == OperandType::Register)
+        return operand.value;
+    
+    return variables[variable_indices.at(operand.name)].reg;
+}
+
+void CodeGenerator::point_at(const int variable) {
+    variable_fixups.push_back({opcodes.size(), variable});
+    emit(0xA000);
+}
+
+void CodeGenerator::load(const int variable) {
+    point_at(variable);
+    emit(0xF065);
+}
+
+void CodeGenerator::store(const int variable) {
+    point_at(variable);
+    emit(0xF055);
+}
+
+int CodeGenerator::read(const Operand& operand, int& next_temporary) {
+    if(operand.type != OperandType::Number && home(operand) >= 0)
+        return home(operand);
+    
+    const int reg = temporaries[next_temporary++];
+    
+    if(operand.type == OperandType::Number) {
+        emit(with_x(0x6000, reg) | operand.value);
+    } else {
+        load(variable_indices.at(operand.name));
+        emit(with_xy(0x8000, reg, scratch_register));
+    }
+    
+    return reg;
+}
+
+void CodeGenerator::assign(const Operand& target, const Operand& value) {
+    const int destination = home(target);
+    const int source = value.type == OperandType::Number ? -1 : home(value);
+    
+    // spilled targets are written through the scratch register
+    const int reg = destination >= 0 ? destination : scratch_register;
+    
+    if(value.type == OperandType::Number) {
+        emit(with_x(0x6000, reg) | value.value);
+    } else if(source >= 0) {
+        if(source != reg)
+            emit(with_xy(0x8000, reg, source));
+    } else {
+        load(variable_indices.at(value.name));
+        if(reg != scratch_register)
+            emit(with_xy(0x8000, reg, scratch_register));
     }
     
-    std::cout << "Finished compilation!" << std::endl;
+    if(destination < 0)
+        store(variable_indices.at(target.name));
 }
 
-void load_compiled_rom() {
-    std::vector<uint8_t> compiled_opcodes;
-    for(auto& opcode : opcodes) {
-        compiled_opcodes.push_back(opcode >> 8); // hi
-        compiled_opcodes.push_back(opcode); // low
+void CodeGenerator::add(const Operand& target, const Operand& value) {
+    const int destination = home(target);
+    int source = value.type == OperandType::Number ? -1 : home(value);
+    
+    // a spilled value is added from the scratch register, or from a temporary when the target needs it
+    if(value.type == OperandType::Variable && source < 0) {
+        load(variable_indices.at(value.name));
+        source = scratch_register;
+        
+        if(destination < 0) {
+            source = temporaries[0];
+            emit(with_xy(0x8000, source, scratch_register));
+        }
     }
     
-    memcpy(state.memory + program_begin, compiled_opcodes.data(), compiled_opcodes.size());
+    const int reg = destination >= 0 ? destination : scratch_register;
+    if(destination < 0)
+        load(variable_indices.at(target.name));
+    
+    // 7XNN, or 8XY4 which also sets VF
+    if(value.type == OperandType::Number)
+        emit(with_x(0x7000, reg) | value.value);
+    else
+        emit(with_xy(0x8004, reg, source));
+    
+    if(destination < 0)
+        store(variable_indices.at(target.name));
+}
+
+void CodeGenerator::draw_char(const Statement& statement) {
+    const Operand& x = *statement.arguments;
+    const Operand& y = *x.next;
+    const Operand& n = *y.next;
+    
+    int next_temporary = 0;
+    const int x_register = read(x, next_temporary);
+    const int y_register = read(y, next_temporary);
+    const int n_register = read(n, next_temporary);
+    
+    // FX29, DXY5
+    emit(with_x(0xF029, n_register));
+    emit(with_xy(0xD005, x_register, y_register));
+}
+
+void CodeGenerator::statement(const Statement& statement) {
+    switch(statement.type) {
+        case StatementType::Declare:
+        case StatementType::Assign:
+            assign(*statement.target, *statement.value);
+            break;
+        case StatementType::Add:
+            add(*statement.target, *statement.value);
+            break;
+        case StatementType::Call:
+            if(statement.name == "label") {
+                labels[statement.arguments->name].opcode = opcodes.size();
+            } else if(statement.name == "jump") {
+                // jumps were found in the same order
+                jumps[emitted_jumps++].opcode = opcodes.size();
+                emit(0x1000);
+            } else {
+                draw_char(statement);
+            }
+            break;
+    }
+}
+
+bool CodeGenerator::generate(const Statement* first) {
+    if(!analyse(first))
+        return false;
+    
+    extend_over_loops();
+    
+    if(!allocate())
+        return false;
+    
+    // the error goes on the statement that took the program over, counting the data section from the start
+    int overflow_line = 0;
+    for(const Statement* current = first; current != nullptr; current = current->next) {
+        statement(*current);
+        
+        if(overflow_line == 0 && opcodes.size() * 2 + data.size() > max_rom_size)
+            overflow_line = current->line;
+    }
+    
+    const size_t size = opcodes.size() * 2 + data.size();
+    if(size > max_rom_size) {
+        error = "the program is " + std::to_string(size) + " bytes, only " + std::to_string(max_rom_size) + " fit";
+        error_line = overflow_line;
+        return false;
+    }
+    
+    for(auto& jump : jumps)
+        opcodes[jump.opcode] |= program_begin + labels[jump.label].opcode * 2;
+    
+    const int data_begin = program_begin + opcodes.size() * 2;
+    for(auto& fixup : variable_fixups)
+        opcodes[fixup.opcode] |= data_begin + variables[fixup.variable].data_offset;
+    
+    return true;
+}
+
+CompiledProgram compile(const std::string_view source) {
+    CompiledProgram program;
+    
+    Arena arena;
+    Parser parser(source, arena);
+    
+    Statement* first = nullptr;
+    if(!parser.parse(first)) {
+        program.error = parser.error;
+        program.error_line = parser.error_line;
+        return program;
+    }
+    
+    CodeGenerator generator;
+    if(!generator.generate(first)) {
+        program.error = generator.error;
+        program.error_line = generator.error_line;
+        return program;
+    }
+    
+    program.rom.reserve(generator.opcodes.size() * 2 + generator.data.size());
+    for(auto opcode : generator.opcodes) {
+        program.rom.push_back(opcode >> 8);
+        program.rom.push_back(opcode & 0xFF);
+    }
+    
+    program.rom.insert(program.rom.end(), generator.data.begin(), generator.data.end());
+    
+    return program;
 }
@@ -1,6 +1,28 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
-void compile(std::string code);
-void load_compiled_rom();
+// a small C-style language, one statement per semicolon:
+//   var count = 3;          declares a variable
+//   v[1] = count;           = and += work on a register or variable, with a number, register or variable
+//   count += 3;
+//   label(main);            jump(main) goes here, labels can be used before they're defined but a jump can't skip
+//                           the declaration of a variable that's used after its label
+//   draw_char(0, 5, count); draws the font character for n at x, y
+// variables are kept in V0-VE for as long as they're live, leaving alone any register the program names itself and
+// VF for flags. when they don't all fit, the ones live longest are spilled to a data section after the code and go
+// through v0, and numbers that need a register go through temporaries taken from the top.
+struct CompiledProgram {
+    // loads at program_begin
+    std::vector<uint8_t> rom;
+    
+    // empty when it compiled, otherwise the first error and the line it's on, which is 0 for errors about the
+    // program as a whole
+    std::string error;
+    int error_line = 0;
+};
+
+CompiledProgram compile(const std::string_view source);
@@ -0,0 +1,163 @@
+#include "disassembler.hpp"
+#include "emu.hpp"
+
+#include <cstdarg>
+
+void format_text(char* text, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(text, disassembly_text_size, format, arguments);
+    va_end(arguments);
+}
+
+void disassemble(const uint16_t opcode, char* text) {
+    const Instruction instruction = decode_operands(opcode);
+    const int x = instruction.x, y = instruction.y, n = instruction.n, nn = instruction.nn, nnn = instruction.nnn;
+    
+    switch(opcode >> 12) {
+        case 0x0:
+            if(opcode == 0x00E0)
+                return format_text(text, "CLS");
+            if(opcode == 0x00EE)
+                return format_text(text, "RET");
+            if((opcode & 0xFFF0) == 0x00C0)
+                return format_text(text, "SCD %d", n);
+            if(opcode == 0x00FB)
+                return format_text(text, "SCR");
+            if(opcode == 0x00FC)
+                return format_text(text, "SCL");
+            if(opcode == 0x00FD)
+                return format_text(text, "EXIT");
+            if(opcode == 0x00FE)
+                return format_text(text, "LOW");
+            if(opcode == 0x00FF)
+                return format_text(text, "HIGH");
+            
+            return format_text(text, "SYS 0x%03X", nnn);
+        case 0x1:
+            return format_text(text, "JP 0x%03X", nnn);
+        case 0x2:
+            return format_text(text, "CALL 0x%03X", nnn);
+        case 0x3:
+            return format_text(text, "SE V%X, 0x%02X", x, nn);
+        case 0x4:
+            return format_text(text, "SNE V%X, 0x%02X", x, nn);
+        case 0x5:
+            if(n == 0x0)
+                return format_text(text, "SE V%X, V%X", x, y);
+            break;
+        case 0x6:
+            return format_text(text, "LD V%X, 0x%02X", x, nn);
+        case 0x7:
+            return format_text(text, "ADD V%X, 0x%02X", x, nn);
+        case 0x8:
+        {
+            static const char* const names[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr
+            };
+            
+            if(names[n] != nullptr)
+                return format_text(text, "%s V%X, V%X", names[n], x, y);
+        }
+            break;
+        case 0x9:
+            if(n == 0x0)
+                return format_text(text, "SNE V%X, V%X", x, y);
+            break;
+        case 0xA:
+            return format_text(text, "LD I, 0x%03X", nnn);
+        case 0xB:
+            return format_text(text, "JP V0, 0x%03X", nnn);
+        case 0xC:
+            return format_text(text, "RND V%X, 0x%02X", x, nn);
+        case 0xD:
+            return format_text(text, "DRW V%X, V%X, %d", x, y, n);
+        case 0xE:
+            if(nn == 0x9E)
+                return format_text(text, "SKP V%X", x);
+            if(nn == 0xA1)
+                return format_text(text, "SKNP V%X", x);
+            break;
+        case 0xF:
+            switch(nn) {
+                case 0x07: return format_text(text, "LD V%X, DT", x);
+                case 0x0A: return format_text(text, "LD V%X, K", x);
+                case 0x15: return format_text(text, "LD DT, V%X", x);
+                case 0x18: return format_text(text, "LD ST, V%X", x);
+                case 0x1E: return format_text(text, "ADD I, V%X", x);
+                case 0x29: return format_text(text, "LD F, V%X", x);
+                case 0x30: return format_text(text, "LD HF, V%X", x);
+                case 0x33: return format_text(text, "LD B, V%X", x);
+                case 0x55: return format_text(text, "LD [I], V%X", x);
+                case 0x65: return format_text(text, "LD V%X, [I]", x);
+                case 0x75: return format_text(text, "LD R, V%X", x);
+                case 0x85: return format_text(text, "LD V%X, R", x);
+            }
+            break;
+    }
+    
+    format_text(text, "DW 0x%04X", opcode);
+}
+
+const char* Disassembly::at(const uint8_t* memory, const uint16_t address) {
+    const int index = address & 0xfff;
+    
+    if(!valid[index]) {
+        disassemble((memory[index] << 8) | memory[(index + 1) & 0xfff], text[index].data());
+        valid[index] = true;
+    }
+    
+    return text[index].data();
+}
+
+void Disassembly::invalidate(const uint16_t address, const int length) {
+    // the opcode starting one byte earlier reads the first byte too
+    for(int i = -1; i < length; i++)
+        valid[(address + i) & 0xfff] = false;
+}
+
+bool disassemble_rom(const char* path, FILE* out) {
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr)
+        return false;
+    
+    uint32_t address = program_begin;
+    
+    auto write_line = [&](const uint16_t opcode) {
+        char text[disassembly_text_size];
+        disassemble(opcode, text);
+        
+        fprintf(out, "0x%03X  %04X  %s\n", address, opcode, text);
+        address += 2;
+    };
+    
+    uint8_t buffer[4096];
+    
+    // a byte left over when a chunk ends halfway through an opcode
+    int carried = -1;
+    
+    size_t size = 0;
+    while((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        size_t i = 0;
+        
+        if(carried >= 0) {
+            write_line((carried << 8) | buffer[i++]);
+            carried = -1;
+        }
+        
+        for(; i + 1 < size; i += 2)
+            write_line((buffer[i] << 8) | buffer[i + 1]);
+        
+        if(i < size)
+            carried = buffer[i];
+    }
+    
+    // an odd length rom ends with half an opcode
+    if(carried >= 0)
+        fprintf(out, "0x%03X  %02X    DB 0x%02X\n", address, carried, carried);
+    
+    fclose(file);
+    
+    return true;
+}
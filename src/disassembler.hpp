@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+// longest text disassemble() writes, with the terminator
+constexpr int disassembly_text_size = 20;
+
+// writes the assembly for one chip-8 or schip opcode into text, like "LD V1, 0x05".
+// anything that isn't an instruction becomes a data word, "DW 0x1234".
+void disassemble(const uint16_t opcode, char* text);
+
+// the text of every address in a machine's memory, formatted the first time it's asked for and kept until a write
+// touches either byte of the opcode. see Machine::disassemble.
+struct Disassembly {
+    const char* at(const uint8_t* memory, const uint16_t address);
+    void invalidate(const uint16_t address, const int length);
+    
+    std::array<std::array<char, disassembly_text_size>, 4096> text;
+    std::array<bool, 4096> valid = {};
+};
+
+// reads a rom file in chunks and writes a line per instruction to out, "0x200  00E0  CLS".
+// returns false if the rom couldn't be opened.
+bool disassemble_rom(const char* path, FILE* out);
@@ -1,192 +1,335 @@
 #include "emu.hpp"
+#include "jit.hpp"
+#include "disassembler.hpp"
 
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <array>
+#include <algorithm>
+#include <utility>
 
-typedef void (*cpu_func)(const uint16_t opcode);
+// the decode cache is used unless the build picked another backend
+#if !defined(CHIP8_DISPATCH_CACHED) && !defined(CHIP8_DISPATCH_SWITCH) && !defined(CHIP8_DISPATCH_GOTO) && !defined(CHIP8_DISPATCH_CONSTEXPR)
+#define CHIP8_DISPATCH_CACHED
+#endif
 
-void null_func(const uint16_t opcode) {
-    printf("unimplemented: %.4X\n", opcode);
+constexpr std::array<uint8_t, 80> chip8_fontset = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// counted instead of printed, this runs once per instruction and stdout can be a report (see chip8-batch)
+void null_func(Machine& machine, const Instruction&) {
+    machine.unimplemented_opcodes++;
 }
 
 template<typename T, size_t Size>
-void safe_call(const std::array<T, Size>& array, const int index, const uint16_t opcode) {
+void safe_call(const std::array<T, Size>& array, const size_t index, Machine& machine, const Instruction& instruction) {
     if(index < Size) {
-        array[index](opcode);
+        array[index](machine, instruction);
     } else {
-        null_func(opcode);
+        null_func(machine, instruction);
     }
 }
 
-// 0x00E0
-void op_e0(const uint16_t opcode) {
-    for(int y = 0; y < screen_height; y++) {
-        for(int x = 0; x < screen_width; x++) {
-            state.pixels[to_coord(x, y)] = 0;
+template<typename T, size_t Size>
+constexpr cpu_func safe_lookup(const std::array<T, Size>& array, const size_t index) {
+    if(index < Size)
+        return array[index];
+    else
+        return null_func;
+}
+
+// one entry per quirk set, indexed by it. make gets the set as a std::integral_constant and returns that
+// instantiation of whatever is templated on it
+template<typename F, size_t... sets>
+constexpr auto make_quirk_table(F make, std::index_sequence<sets...>) {
+    return std::array{make(std::integral_constant<QuirkSet, sets>())...};
+}
+
+template<typename F>
+constexpr auto make_quirk_table(F make) {
+    return make_quirk_table(make, std::make_index_sequence<quirk_set_count>());
+}
+
+constexpr uint64_t rotate_right(const uint64_t value, const int shift) {
+    return (value >> (shift & 63)) | (value << ((64 - shift) & 63));
+}
+
+void expand_framebuffer(const EmulatorState& state, uint8_t* pixels) {
+    const int width = state.width();
+    
+    for(int y = 0; y < state.height(); y++) {
+        for(int x = 0; x < width; x++)
+            pixels[y * width + x] = (state.framebuffer[y][x / 64] >> (63 - x % 64)) & 1;
+    }
+}
+
+void pack_framebuffer_rows(const EmulatorState& state, uint32_t* texels, const int begin, const int end) {
+    for(int y = begin; y < end; y++) {
+        for(const uint64_t word : state.framebuffer[y]) {
+            *texels++ = word >> 32;
+            *texels++ = word;
         }
     }
+}
+
+// xors a sprite row (its pixels at the top bits of sprite) into the framebuffer at x, returns whether it collided
+bool draw_row(EmulatorState& state, uint64_t* row, const uint64_t sprite, const int x) {
+    if(!state.hires) {
+        // the sprite row moved into place, wrapping around the right edge
+        const uint64_t moved = rotate_right(sprite, x % screen_width);
+        const bool collided = (row[0] & moved) != 0;
+        
+        row[0] ^= moved;
+        return collided;
+    }
+    
+    // the same thing over both words of a hires row
+    const int shift = x % hires_screen_width;
+    
+    uint64_t left = shift < 64 ? sprite : 0;
+    uint64_t right = shift < 64 ? 0 : sprite;
+    
+    if(shift % 64 != 0) {
+        const int bits = shift % 64;
+        const uint64_t new_left = (left >> bits) | (right << (64 - bits));
+        const uint64_t new_right = (right >> bits) | (left << (64 - bits));
+        
+        left = new_left;
+        right = new_right;
+    }
+    
+    const bool collided = ((row[0] & left) | (row[1] & right)) != 0;
+    
+    row[0] ^= left;
+    row[1] ^= right;
+    return collided;
+}
+
+// 00CN
+void op_scroll_down(Machine& machine, const Instruction& instruction) {
+    const int height = machine.state.height();
+    const int rows = std::min<int>(instruction.n, height);
+    
+    auto& framebuffer = machine.state.framebuffer;
+    memmove(framebuffer[rows], framebuffer[0], (height - rows) * sizeof(framebuffer[0]));
+    memset(framebuffer[0], 0, rows * sizeof(framebuffer[0]));
+    
+    machine.state.mark_rows_dirty(0, height);
+    machine.state.draw_dirty = true;
+    
+    machine.state.PC += 2;
+}
+
+// 00FB
+void op_scroll_right(Machine& machine, const Instruction&) {
+    for(auto& row : machine.state.framebuffer) {
+        row[1] = (row[1] >> 4) | (row[0] << 60);
+        row[0] >>= 4;
+        
+        // low resolution rows end at the left word
+        if(!machine.state.hires)
+            row[1] = 0;
+    }
     
-    state.draw_dirty = true;
+    machine.state.mark_rows_dirty(0, machine.state.height());
+    machine.state.draw_dirty = true;
     
-    state.PC += 2;
+    machine.state.PC += 2;
+}
+
+// 00FC
+void op_scroll_left(Machine& machine, const Instruction&) {
+    for(auto& row : machine.state.framebuffer) {
+        row[0] = (row[0] << 4) | (row[1] >> 60);
+        row[1] <<= 4;
+    }
+    
+    machine.state.mark_rows_dirty(0, machine.state.height());
+    machine.state.draw_dirty = true;
+    
+    machine.state.PC += 2;
+}
+
+// 00FE & 00FF, switching resolution clears the screen
+void op_set_resolution(Machine& machine, const Instruction& instruction) {
+    machine.state.hires = instruction.n == 0xF;
+    
+    memset(machine.state.framebuffer, 0, sizeof(machine.state.framebuffer));
+    machine.state.mark_rows_dirty(0, machine.state.height());
+    machine.state.draw_dirty = true;
+    
+    machine.state.PC += 2;
+}
+
+// 0x00E0
+void op_e0(Machine& machine, const Instruction&) {
+    memset(machine.state.framebuffer, 0, sizeof(machine.state.framebuffer));
+    
+    machine.state.mark_rows_dirty(0, machine.state.height());
+    machine.state.draw_dirty = true;
+    
+    machine.state.PC += 2;
 }
 
 // 0x00EE
-void op_ee(const uint16_t opcode) {
-    state.stack_pointer--;
-    state.PC = state.stack[state.stack_pointer];
-    state.PC += 2;
+void op_ee(Machine& machine, const Instruction&) {
+    machine.state.stack_pointer--;
+    machine.state.PC = machine.state.stack[machine.state.stack_pointer];
+    machine.state.PC += 2;
 }
 
-constexpr std::array op0_func = {
-    op_e0, // e0
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    null_func,
-    op_ee // ee
-};
+// 00NN, indexed by NN
+constexpr std::array<cpu_func, 256> make_op0_func() {
+    std::array<cpu_func, 256> table = {};
+    for(auto& func : table)
+        func = null_func;
+    
+    for(int n = 0; n < 16; n++)
+        table[0xC0 + n] = op_scroll_down; // cn
+    
+    table[0xE0] = op_e0; // e0
+    table[0xEE] = op_ee; // ee
+    table[0xFB] = op_scroll_right; // fb
+    table[0xFC] = op_scroll_left; // fc
+    table[0xFE] = op_set_resolution; // fe
+    table[0xFF] = op_set_resolution; // ff
+    
+    return table;
+}
 
-void operation0(const uint16_t opcode) {
-    safe_call(op0_func, opcode & 0x000f, opcode);
+constexpr std::array<cpu_func, 256> op0_func = make_op0_func();
+
+void operation0(Machine& machine, const Instruction& instruction) {
+    if(instruction.x == 0)
+        op0_func[instruction.nn](machine, instruction);
+    else
+        null_func(machine, instruction);
 }
 
 // 1NNN
-void operation1(const uint16_t opcode) {
-    const uint16_t nnn = opcode & 0x0fff;
-
-    state.PC = nnn;
+void operation1(Machine& machine, const Instruction& instruction) {
+    machine.state.PC = instruction.nnn;
 }
 
 // 2NNN
-void operation2(const uint16_t opcode) {
-    const uint16_t nnn = opcode & 0x0fff;
-
-    state.stack[state.stack_pointer] = state.PC;
-    state.stack_pointer++;
-    state.PC = nnn;
+void operation2(Machine& machine, const Instruction& instruction) {
+    machine.state.stack[machine.state.stack_pointer] = machine.state.PC;
+    machine.state.stack_pointer++;
+    machine.state.PC = instruction.nnn;
 }
 
 // 3XNN
-void operation3(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t nn = opcode & 0x00ff;
-
-    if(state.v[x] == nn)
-        state.PC += 4;
+void operation3(Machine& machine, const Instruction& instruction) {
+    if(machine.state.v[instruction.x] == instruction.nn)
+        machine.state.PC += 4;
     else
-        state.PC += 2;
+        machine.state.PC += 2;
 }
 
 // 4XNN
-void operation4(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t nn = opcode & 0x00ff;
-    
-    if(state.v[x] != nn)
-        state.PC += 4;
+void operation4(Machine& machine, const Instruction& instruction) {
+    if(machine.state.v[instruction.x] != instruction.nn)
+        machine.state.PC += 4;
     else
-        state.PC += 2;
+        machine.state.PC += 2;
 }
 
 // 6XNN
-void operation6(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t nn = opcode & 0x00ff;
-    
-    state.v[x] = nn;
+void operation6(Machine& machine, const Instruction& instruction) {
+    machine.state.v[instruction.x] = instruction.nn;
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // &XNN
-void operation7(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t nn = opcode & 0x00ff;
+void operation7(Machine& machine, const Instruction& instruction) {
+    machine.state.v[instruction.x] += instruction.nn;
     
-    state.v[x] += nn;
-    
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // 8XY0
-void op8_func0(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
-    
-    state.v[x] = state.v[y];
-    state.PC += 2;
+void op8_func0(Machine& machine, const Instruction& instruction) {
+    machine.state.v[instruction.x] = machine.state.v[instruction.y];
+    machine.state.PC += 2;
 }
 
 // 8XY1
-void op8_func2(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
+void op8_func2(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    const uint8_t y = instruction.y;
     
-    state.v[x] = state.v[x] & state.v[y];
-    state.PC += 2;
+    machine.state.v[x] = machine.state.v[x] & machine.state.v[y];
+    machine.state.PC += 2;
 }
 
 // 8XY3
-void op8_func3(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
+void op8_func3(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    const uint8_t y = instruction.y;
     
-    state.v[x] = state.v[x] ^ state.v[y];
-    state.PC += 2;
+    machine.state.v[x] = machine.state.v[x] ^ machine.state.v[y];
+    machine.state.PC += 2;
 }
 
 // 8XY4
-void op8_func4(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
+void op8_func4(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    const uint8_t y = instruction.y;
     
     // TODO: implement tests
-    if(state.v[y] < (0xFF - state.v[x]))
-        state.v[0xF] = 1;
+    if(machine.state.v[y] < (0xFF - machine.state.v[x]))
+        machine.state.v[0xF] = 1;
     else
-        state.v[0xF] = 0;
+        machine.state.v[0xF] = 0;
     
-    state.v[x] += state.v[y];
-    state.PC += 2;
+    machine.state.v[x] += machine.state.v[y];
+    machine.state.PC += 2;
 }
 
 // 8XY5
-void op8_func5(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
+void op8_func5(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    const uint8_t y = instruction.y;
     
     // TODO: implement tests
-    if(state.v[y] > state.v[x])
-        state.v[0xF] = 0;
+    if(machine.state.v[y] > machine.state.v[x])
+        machine.state.v[0xF] = 0;
     else
-        state.v[0xF] = 1;
+        machine.state.v[0xF] = 1;
     
-    state.v[x] -= state.v[y];
-    state.PC += 2;
+    machine.state.v[x] -= machine.state.v[y];
+    machine.state.PC += 2;
 }
 
 // 8XY6
-void op8_func6(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
+void op8_func6(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
     
-    state.v[0xF] = (state.v[x] & 1);
-    state.v[x] >>= 1;
+    machine.state.v[0xF] = (machine.state.v[x] & 1);
+    machine.state.v[x] >>= 1;
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
-const std::array op8_func = {
+constexpr std::array op8_func = {
     op8_func0,
     null_func,
     op8_func2,
@@ -196,209 +339,209 @@ const std::array op8_func = {
     op8_func6
 };
 
-void operation8(const uint16_t opcode) {
-    safe_call(op8_func, opcode & 0x000f, opcode);
+void operation8(Machine& machine, const Instruction& instruction) {
+    safe_call(op8_func, instruction.n, machine, instruction);
 }
 
 // 9XY0
-void operation9(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
-    
-    if(state.v[x] != state.v[y])
-        state.PC += 4;
+void operation9(Machine& machine, const Instruction& instruction) {
+    if(machine.state.v[instruction.x] != machine.state.v[instruction.y])
+        machine.state.PC += 4;
     else
-        state.PC += 2;
+        machine.state.PC += 2;
 }
 
 // ANNN
-void operationA(const uint16_t opcode) {
-    const uint16_t nnn = opcode & 0x0fff;
-
-    state.I = nnn;
-    state.PC += 2;
+void operationA(Machine& machine, const Instruction& instruction) {
+    machine.state.I = instruction.nnn;
+    machine.state.PC += 2;
 }
 
 // CXNN
-void operationC(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t nn = opcode & 0x00ff;
-
-    srand(time(nullptr));
-    state.v[x] = (rand() % 0xFF) & nn;
-    state.PC += 2;
+void operationC(Machine& machine, const Instruction& instruction) {
+    uint32_t random = machine.state.random_state;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    machine.state.random_state = random;
+    
+    machine.state.v[instruction.x] = random & instruction.nn;
+    machine.state.PC += 2;
 }
 
 // DXYN
-void operationD(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-    const uint8_t y = (opcode & 0x00f0) >> 4;
-    const uint8_t n = opcode & 0x000f;
-
-    const uint8_t x_pos = state.v[x];
-    const uint8_t y_pos = state.v[y];
-    const uint8_t height = n;
+template<QuirkSet quirks>
+void operationD(Machine& machine, const Instruction& instruction) {
+    const uint8_t x_pos = machine.state.v[instruction.x];
+    const uint8_t y_pos = machine.state.v[instruction.y];
+    
+    // DXY0 is a 16x16 sprite in hires, two bytes per row
+    const bool large = machine.state.hires && instruction.n == 0;
+    const uint8_t height = large ? 16 : instruction.n;
+    
+    machine.state.v[0xF] = 0;
+    machine.state.draw_dirty = true;
+    
+    // sprites that wrap past the bottom dirty the whole screen height
+    const int first_row = y_pos % machine.state.height();
+    if(first_row + height > machine.state.height())
+        machine.state.mark_rows_dirty(0, machine.state.height());
+    else
+        machine.state.mark_rows_dirty(first_row, first_row + height);
     
-    state.v[0xF] = 0;
-    state.draw_dirty = true;
-
     for(int y = 0; y < height; y++) {
-        const uint8_t pixel = state.memory[state.I + y];
+        const auto& memory = machine.state.memory;
         
-        for(int x = 0; x < 8; x++) {
-            const int final_x = (x_pos + x) % screen_width;
-            const int final_y = (y_pos + y) % screen_height;
+        uint64_t sprite;
+        if(large)
+            sprite = (uint64_t(memory[(machine.state.I + y * 2) & 0xfff]) << 56) | (uint64_t(memory[(machine.state.I + y * 2 + 1) & 0xfff]) << 48);
+        else
+            sprite = uint64_t(memory[(machine.state.I + y) & 0xfff]) << 56;
+        
+        uint64_t* row = machine.state.framebuffer[(y_pos + y) % machine.state.height()];
+        
+        if(draw_row(machine.state, row, sprite, x_pos)) {
+            machine.state.v[0xF] = 1;
             
-            if((pixel & (0x80 >> x)) != 0) {
-                if(state.pixels[to_coord(final_x, final_y)] == 1) {
-                    state.v[0xF] = 1;
-                    
-                    if(options.enable_anti_flicker)
-                        state.draw_dirty = false; // anti-flicker mechanism
-                }
-                
-                state.pixels[to_coord(final_x, final_y)] ^= 1;
-            }
+            if constexpr((quirks & quirk_anti_flicker) != 0)
+                machine.state.draw_dirty = false; // anti-flicker mechanism
         }
     }
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // EX9E & EXA1
-void operationE(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    switch(opcode & 0x00ff) {
+void operationE(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    
+    switch(instruction.nn) {
         case 0x9E:
         {
-            if(state.keys[state.v[x]] == 1)
-                state.PC += 4;
+            if(machine.state.keys[machine.state.v[x]] == 1)
+                machine.state.PC += 4;
             else
-                state.PC += 2;
+                machine.state.PC += 2;
         }
             break;
         case 0xA1:
         {
-            if(state.keys[state.v[x]] == 0)
-                state.PC += 4;
+            if(machine.state.keys[machine.state.v[x]] == 0)
+                machine.state.PC += 4;
             else
-                state.PC += 2;
+                machine.state.PC += 2;
         }
             break;
     }
 }
 
 // FX07
-void opF_func7(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    state.v[x] = state.delay_timer;
+void opF_func7(Machine& machine, const Instruction& instruction) {
+    machine.state.v[instruction.x] = machine.state.delay_timer;
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // FX0A
-void opF_funcA(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
+void opF_funcA(Machine& machine, const Instruction& instruction) {
     for(int i = 0; i < 16; i++) {
-        if(state.keys[i] != 0) {
-            state.v[x] = i;
-            state.PC += 2;
+        if(machine.state.keys[i] != 0) {
+            machine.state.v[instruction.x] = i;
+            machine.state.PC += 2;
         }
     }
 }
 
 // FX55/FX65 & FX15
-void opF_func5(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    switch((opcode & 0x00F0) >> 4) {
+template<QuirkSet quirks>
+void opF_func5(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    
+    switch(instruction.y) {
         case 0x6:
         {
             for(int i = 0; i <= x; i++)
-                state.v[i] = state.memory[state.I + i];
+                machine.state.v[i] = machine.state.memory[machine.state.I + i];
             
-            if(options.emulate_original)
-                state.I += x + 1;
+            if constexpr((quirks & quirk_increment_index) != 0)
+                machine.state.I += x + 1;
             
-            state.PC += 2;
+            machine.state.PC += 2;
         }
             break;
         case 0x5:
         {
             for(int i = 0; i <= x; i++)
-                state.memory[state.I + i] = state.v[i];
+                machine.state.memory[machine.state.I + i] = machine.state.v[i];
+            
+            machine.invalidate_decode_cache(machine.state.I, x + 1);
             
-            if(options.emulate_original)
-                state.I += x + 1;
+            if constexpr((quirks & quirk_increment_index) != 0)
+                machine.state.I += x + 1;
             
-            state.PC += 2;
+            machine.state.PC += 2;
         }
             break;
         case 0x1:
         {
-            state.delay_timer = state.v[x];
+            machine.state.delay_timer = machine.state.v[x];
             
-            state.PC += 2;
+            machine.state.PC += 2;
         }
             break;
     }
 }
 
 // FX18
-void opF_func8(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    state.sound_timer = state.v[x];
+void opF_func8(Machine& machine, const Instruction& instruction) {
+    machine.state.sound_timer = machine.state.v[instruction.x];
+    machine.sound_timer_writes++;
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // FX29
-void opF_func9(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    state.I = state.v[x] * 0x5;
+void opF_func9(Machine& machine, const Instruction& instruction) {
+    machine.state.I = machine.state.v[instruction.x] * 0x5;
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // FX1E
-void opF_funcE(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
-
-    if((state.I + state.v[x]) > 0xFFF)
-        state.v[15] = 1;
+void opF_funcE(Machine& machine, const Instruction& instruction) {
+    const uint8_t x = instruction.x;
+    
+    if((machine.state.I + machine.state.v[x]) > 0xFFF)
+        machine.state.v[15] = 1;
     else
-        state.v[15] = 0;
+        machine.state.v[15] = 0;
     
-    state.I += state.v[x];
+    machine.state.I += machine.state.v[x];
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
 // FX33
-void opF_func3(const uint16_t opcode) {
-    const uint8_t x = (opcode & 0x0f00) >> 8;
+void opF_func3(Machine& machine, const Instruction& instruction) {
+    int decimal_rep = machine.state.v[instruction.x];
     
-    int decimal_rep = state.v[x];
+    machine.state.memory[machine.state.I] = (decimal_rep % 1000) / 100;
+    machine.state.memory[machine.state.I + 1] = (decimal_rep % 100) / 10;
+    machine.state.memory[machine.state.I + 2] = (decimal_rep % 10);
     
-    state.memory[state.I] = (decimal_rep % 1000) / 100;
-    state.memory[state.I + 1] = (decimal_rep % 100) / 10;
-    state.memory[state.I + 2] = (decimal_rep % 10);
+    machine.invalidate_decode_cache(machine.state.I, 3);
     
-    state.PC += 2;
+    machine.state.PC += 2;
 }
 
-const std::array opF_func = {
+template<QuirkSet quirks>
+constexpr std::array opF_func = {
     null_func,
     null_func,
     null_func,
     opF_func3,
     null_func,
-    opF_func5,
+    opF_func5<quirks>,
     null_func,
     opF_func7,
     opF_func8,
@@ -410,10 +553,12 @@ const std::array opF_func = {
     opF_funcE
 };
 
-void operationF(const uint16_t opcode) {
-    safe_call(opF_func, opcode & 0x000F, opcode);
+template<QuirkSet quirks>
+void operationF(Machine& machine, const Instruction& instruction) {
+    safe_call(opF_func<quirks>, instruction.n, machine, instruction);
 }
 
+template<QuirkSet quirks>
 constexpr std::array cpu_opcode = {
     operation0, // 0x0,
     operation1, // 0x1
@@ -428,19 +573,628 @@ constexpr std::array cpu_opcode = {
     operationA, // 0xA
     null_func, // 0xB
     operationC, // 0xC
-    operationD, // 0xD
+    operationD<quirks>, // 0xD
     operationE, // 0xE
-    operationF, // 0xF
+    operationF<quirks>, // 0xF
+};
+
+// walks the dispatch tables down to the final handler, so it only has to happen once per opcode
+template<QuirkSet quirks>
+constexpr cpu_func find_handler(const uint16_t opcode) {
+    const int index = opcode & 0x000f;
+    
+    switch(opcode >> 12) {
+        case 0x0:
+            return (opcode & 0x0F00) == 0 ? op0_func[opcode & 0x00ff] : null_func;
+        case 0x8:
+            return safe_lookup(op8_func, index);
+        case 0xF:
+            return safe_lookup(opF_func<quirks>, index);
+        default:
+            return cpu_opcode<quirks>[opcode >> 12];
+    }
+}
+
+constexpr auto handler_finders = make_quirk_table([](auto quirks) {
+    return find_handler<decltype(quirks)::value>;
+});
+
+cpu_func resolve_handler(const uint16_t opcode, const QuirkSet quirks) {
+    return handler_finders[quirks](opcode);
+}
+
+// the dispatch backend is picked at compile time with CHIP8_DISPATCH, they all share the handlers above
+#if defined(CHIP8_DISPATCH_SWITCH)
+
+const char* const dispatch_backend = "switch";
+
+struct DecodeCache {};
+
+// the low bits only select the handler in these families, like the nested tables above
+constexpr std::array<uint16_t, 16> dispatch_masks = {
+    0xFFFF, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000,
+    0xF00F, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF000, 0xF00F
+};
+
+template<QuirkSet quirks>
+void execute(Machine& machine, const uint16_t opcode) {
+    const Instruction instruction = decode_operands(opcode);
+    
+    switch(opcode & dispatch_masks[opcode >> 12]) {
+        case 0x00E0: op_e0(machine, instruction); break;
+        case 0x00EE: op_ee(machine, instruction); break;
+        case 0x00FB: op_scroll_right(machine, instruction); break;
+        case 0x00FC: op_scroll_left(machine, instruction); break;
+        case 0x00FE: op_set_resolution(machine, instruction); break;
+        case 0x00FF: op_set_resolution(machine, instruction); break;
+        case 0x1000: operation1(machine, instruction); break;
+        case 0x2000: operation2(machine, instruction); break;
+        case 0x3000: operation3(machine, instruction); break;
+        case 0x4000: operation4(machine, instruction); break;
+        case 0x6000: operation6(machine, instruction); break;
+        case 0x7000: operation7(machine, instruction); break;
+        case 0x8000: op8_func0(machine, instruction); break;
+        case 0x8002: op8_func2(machine, instruction); break;
+        case 0x8003: op8_func3(machine, instruction); break;
+        case 0x8004: op8_func4(machine, instruction); break;
+        case 0x8005: op8_func5(machine, instruction); break;
+        case 0x8006: op8_func6(machine, instruction); break;
+        case 0x9000: operation9(machine, instruction); break;
+        case 0xA000: operationA(machine, instruction); break;
+        case 0xC000: operationC(machine, instruction); break;
+        case 0xD000: operationD<quirks>(machine, instruction); break;
+        case 0xE000: operationE(machine, instruction); break;
+        case 0xF003: opF_func3(machine, instruction); break;
+        case 0xF005: opF_func5<quirks>(machine, instruction); break;
+        case 0xF007: opF_func7(machine, instruction); break;
+        case 0xF008: opF_func8(machine, instruction); break;
+        case 0xF009: opF_func9(machine, instruction); break;
+        case 0xF00A: opF_funcA(machine, instruction); break;
+        case 0xF00E: opF_funcE(machine, instruction); break;
+        default:
+            // 00CN has its scroll distance in the low nibble
+            if((opcode & 0xFFF0) == 0x00C0)
+                op_scroll_down(machine, instruction);
+            else
+                null_func(machine, instruction);
+            break;
+    }
+}
+
+template<QuirkSet quirks>
+void execute_count(Machine& machine, const uint64_t count) {
+    for(uint64_t i = 0; i < count; i++)
+        execute<quirks>(machine, machine.fetch_opcode(machine.state.PC));
+}
+
+constexpr auto executors = make_quirk_table([](auto quirks) {
+    return execute<decltype(quirks)::value>;
+});
+
+constexpr auto interpreters = make_quirk_table([](auto quirks) {
+    return execute_count<decltype(quirks)::value>;
+});
+
+void Machine::process_opcode(const uint16_t opcode) {
+    executors[options.quirks()](*this, opcode);
+}
+
+void Machine::step() {
+    process_opcode(fetch_opcode(state.PC));
+}
+
+void interpret(Machine& machine, const uint64_t count) {
+    interpreters[machine.options.quirks()](machine, count);
+}
+
+#elif defined(CHIP8_DISPATCH_GOTO)
+
+#if !defined(__GNUC__)
+#error "the computed goto dispatch backend needs GCC or Clang"
+#endif
+
+const char* const dispatch_backend = "goto";
+
+struct DecodeCache {};
+
+// threaded code, every handler jumps straight to the next instruction's handler instead of returning
+template<QuirkSet quirks>
+void execute_threaded(Machine& machine, uint16_t opcode, uint64_t count) {
+    static const void* const labels[16] = {
+        &&family0, &&op1, &&op2, &&op3, &&op4, &&unimplemented, &&op6, &&op7,
+        &&family8, &&op9, &&opA, &&unimplemented, &&opC, &&opD, &&opE, &&familyF
+    };
+    
+    static const void* const labels8[16] = {
+        &&op8XY0, &&unimplemented, &&op8XY2, &&op8XY3,
+        &&op8XY4, &&op8XY5, &&op8XY6, &&unimplemented,
+        &&unimplemented, &&unimplemented, &&unimplemented, &&unimplemented,
+        &&unimplemented, &&unimplemented, &&unimplemented, &&unimplemented
+    };
+    
+    static const void* const labelsF[16] = {
+        &&unimplemented, &&unimplemented, &&unimplemented, &&opFX33,
+        &&unimplemented, &&opFX55, &&unimplemented, &&opFX07,
+        &&opFX18, &&opFX29, &&opFX0A, &&unimplemented,
+        &&unimplemented, &&unimplemented, &&opFX1E, &&unimplemented
+    };
+    
+    if(count == 0)
+        return;
+    
+    Instruction instruction;
+
+#define DISPATCH() \
+    instruction = decode_operands(opcode); \
+    goto *labels[opcode >> 12]
+
+#define NEXT() \
+    if(--count == 0) \
+        return; \
+    opcode = machine.fetch_opcode(machine.state.PC); \
+    DISPATCH()
+    
+    DISPATCH();
+
+family0:
+    if(opcode == 0x00E0) goto op00E0;
+    if(opcode == 0x00EE) goto op00EE;
+    if(opcode == 0x00FB) goto op00FB;
+    if(opcode == 0x00FC) goto op00FC;
+    if(opcode == 0x00FE || opcode == 0x00FF) goto op00FE;
+    if((opcode & 0xFFF0) == 0x00C0) goto op00CN;
+    goto unimplemented;
+
+family8: goto *labels8[instruction.n];
+familyF: goto *labelsF[instruction.n];
+
+op00E0: op_e0(machine, instruction); NEXT();
+op00EE: op_ee(machine, instruction); NEXT();
+op00CN: op_scroll_down(machine, instruction); NEXT();
+op00FB: op_scroll_right(machine, instruction); NEXT();
+op00FC: op_scroll_left(machine, instruction); NEXT();
+op00FE: op_set_resolution(machine, instruction); NEXT();
+op1: operation1(machine, instruction); NEXT();
+op2: operation2(machine, instruction); NEXT();
+op3: operation3(machine, instruction); NEXT();
+op4: operation4(machine, instruction); NEXT();
+op6: operation6(machine, instruction); NEXT();
+op7: operation7(machine, instruction); NEXT();
+op8XY0: op8_func0(machine, instruction); NEXT();
+op8XY2: op8_func2(machine, instruction); NEXT();
+op8XY3: op8_func3(machine, instruction); NEXT();
+op8XY4: op8_func4(machine, instruction); NEXT();
+op8XY5: op8_func5(machine, instruction); NEXT();
+op8XY6: op8_func6(machine, instruction); NEXT();
+op9: operation9(machine, instruction); NEXT();
+opA: operationA(machine, instruction); NEXT();
+opC: operationC(machine, instruction); NEXT();
+opD: operationD<quirks>(machine, instruction); NEXT();
+opE: operationE(machine, instruction); NEXT();
+opFX07: opF_func7(machine, instruction); NEXT();
+opFX0A: opF_funcA(machine, instruction); NEXT();
+opFX18: opF_func8(machine, instruction); NEXT();
+opFX1E: opF_funcE(machine, instruction); NEXT();
+opFX29: opF_func9(machine, instruction); NEXT();
+opFX33: opF_func3(machine, instruction); NEXT();
+opFX55: opF_func5<quirks>(machine, instruction); NEXT();
+unimplemented: null_func(machine, instruction); NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+
+constexpr auto threaded_interpreters = make_quirk_table([](auto quirks) {
+    return execute_threaded<decltype(quirks)::value>;
+});
+
+void Machine::process_opcode(const uint16_t opcode) {
+    threaded_interpreters[options.quirks()](*this, opcode, 1);
+}
+
+void Machine::step() {
+    process_opcode(fetch_opcode(state.PC));
+}
+
+void interpret(Machine& machine, const uint64_t count) {
+    threaded_interpreters[machine.options.quirks()](machine, machine.fetch_opcode(machine.state.PC), count);
+}
+
+#elif defined(CHIP8_DISPATCH_CONSTEXPR)
+
+const char* const dispatch_backend = "constexpr";
+
+struct DecodeCache {};
+
+// the opcode is only read by the handler for unimplemented opcodes, everyone else has it baked in
+typedef void (*fixed_func)(Machine& machine, const uint16_t opcode);
+
+void fixed_null_handler(Machine& machine, const uint16_t opcode) {
+    null_func(machine, decode_operands(opcode));
+}
+
+// operand bits the handler never reads are cleared, so opcodes that behave the same share one instantiation
+constexpr uint16_t canonical_opcode(const uint16_t opcode) {
+    const cpu_func func = find_handler<0>(opcode);
+    
+    if(func == operation9)
+        return opcode & 0xFFF0;
+    
+    if((opcode >> 12) == 0xF && func != opF_func5<0>)
+        return opcode & 0xFF0F;
+    
+    return opcode;
+}
+
+// the same for quirks, only DXYN and FX55/FX65 read any
+constexpr QuirkSet canonical_quirks(const uint16_t opcode, const QuirkSet quirks) {
+    if((opcode >> 12) == 0xD)
+        return quirks & quirk_anti_flicker;
+    
+    if((opcode & 0xF00F) == 0xF005)
+        return quirks & quirk_increment_index;
+    
+    return 0;
+}
+
+template<QuirkSet quirks, uint16_t opcode>
+void fixed_handler(Machine& machine, const uint16_t) {
+    static constexpr Instruction instruction = decode_operands(opcode);
+    constexpr cpu_func func = find_handler<quirks>(opcode);
+    
+    func(machine, instruction);
+}
+
+template<QuirkSet quirks, size_t... opcodes>
+constexpr std::array<fixed_func, sizeof...(opcodes)> make_fixed_handlers(std::index_sequence<opcodes...>) {
+    return {(find_handler<0>(opcodes) == null_func ? fixed_null_handler : fixed_handler<canonical_quirks(opcodes, quirks), canonical_opcode(opcodes)>)...};
+}
+
+// every possible opcode gets its own handler, with the operands and quirks baked in as constants
+template<QuirkSet quirks>
+constexpr std::array<fixed_func, 65536> fixed_handlers = make_fixed_handlers<quirks>(std::make_index_sequence<65536>());
+
+constexpr auto fixed_handler_tables = make_quirk_table([](auto quirks) {
+    return fixed_handlers<decltype(quirks)::value>.data();
+});
+
+void Machine::process_opcode(const uint16_t opcode) {
+    fixed_handler_tables[options.quirks()][opcode](*this, opcode);
+}
+
+void Machine::step() {
+    process_opcode(fetch_opcode(state.PC));
+}
+
+void interpret(Machine& machine, const uint64_t count) {
+    const fixed_func* handlers = fixed_handler_tables[machine.options.quirks()];
+    
+    for(uint64_t i = 0; i < count; i++) {
+        const uint16_t opcode = machine.fetch_opcode(machine.state.PC);
+        handlers[opcode](machine, opcode);
+    }
+}
+
+#elif defined(CHIP8_DISPATCH_CACHED)
+
+const char* const dispatch_backend = "cached";
+
+void Machine::process_opcode(const uint16_t opcode) {
+    resolve_handler(opcode, options.quirks())(*this, decode_operands(opcode));
+}
+
+struct DecodedInstruction;
+
+// runs a whole fused sequence starting at entries[0] (each instruction is two entries apart), and returns how
+// many instructions actually executed
+typedef int (*fused_func)(Machine& machine, const DecodedInstruction* entries);
+
+struct DecodedInstruction {
+    cpu_func func;
+    Instruction instruction;
+    
+    // set when this slot starts a common instruction sequence, which then runs as one handler
+    fused_func fused = nullptr;
+    int fused_length = 0;
 };
 
-void process_opcode(const uint16_t opcode) {
-    safe_call(cpu_opcode, opcode >> 12, opcode);
+void decode_and_execute(Machine& machine, const Instruction& instruction);
+
+// one entry for every address, since some roms run code at odd addresses.
+// undecoded slots decode themselves on first execution.
+struct DecodeCache {
+    DecodeCache() {
+        for(auto& entry : entries)
+            entry.func = decode_and_execute;
+    }
+    
+    std::array<DecodedInstruction, 4096> entries = {};
+    
+    // every handler in entries is the instantiation for this set
+    QuirkSet quirks = EmuOptions().quirks();
+};
+
+// ANNN, DXYN
+template<QuirkSet quirks>
+int fused_sprite_draw(Machine& machine, const DecodedInstruction* entries) {
+    operationA(machine, entries[0].instruction);
+    operationD<quirks>(machine, entries[2].instruction);
+    
+    return 2;
+}
+
+constexpr auto fused_sprite_draws = make_quirk_table([](auto quirks) {
+    return fused_sprite_draw<decltype(quirks)::value>;
+});
+
+// 6XNN, 6XNN
+int fused_register_setup(Machine& machine, const DecodedInstruction* entries) {
+    operation6(machine, entries[0].instruction);
+    operation6(machine, entries[2].instruction);
+    
+    return 2;
+}
+
+// 3XNN/4XNN/9XY0/EX9E/EXA1, 1NNN
+template<cpu_func skip>
+int fused_skip_jump(Machine& machine, const DecodedInstruction* entries) {
+    const uint16_t jump_address = machine.state.PC + 2;
+    
+    skip(machine, entries[0].instruction);
+    if(machine.state.PC != jump_address)
+        return 1;
+    
+    operation1(machine, entries[2].instruction);
+    
+    return 2;
+}
+
+// FX07, skip, 1NNN
+template<cpu_func skip>
+int fused_timer_poll(Machine& machine, const DecodedInstruction* entries) {
+    opF_func7(machine, entries[0].instruction);
+    
+    return 1 + fused_skip_jump<skip>(machine, entries + 2);
+}
+
+bool is_decoded(const DecodeCache& cache, const int index) {
+    return size_t(index) < cache.entries.size() && cache.entries[index].func != decode_and_execute;
+}
+
+fused_func find_skip_jump(const cpu_func skip, const bool timer_poll) {
+    if(skip == operation3)
+        return timer_poll ? fused_timer_poll<operation3> : fused_skip_jump<operation3>;
+    else if(skip == operation4)
+        return timer_poll ? fused_timer_poll<operation4> : fused_skip_jump<operation4>;
+    else if(skip == operation9)
+        return timer_poll ? fused_timer_poll<operation9> : fused_skip_jump<operation9>;
+    else if(skip == operationE)
+        return timer_poll ? fused_timer_poll<operationE> : fused_skip_jump<operationE>;
+    
+    return nullptr;
+}
+
+// looks for a known sequence starting at this slot, the slots after it have to be decoded already
+void fuse(DecodeCache& cache, const int index) {
+    auto& entry = cache.entries[index];
+    entry.fused = nullptr;
+    entry.fused_length = 0;
+    
+    if(!is_decoded(cache, index) || !is_decoded(cache, index + 2))
+        return;
+    
+    const cpu_func first = entry.func;
+    const cpu_func second = cache.entries[index + 2].func;
+    
+    if(first == operationA && second == resolve_handler(0xD000, cache.quirks)) {
+        entry.fused = fused_sprite_draws[cache.quirks];
+        entry.fused_length = 2;
+    } else if(first == operation6 && second == operation6) {
+        entry.fused = fused_register_setup;
+        entry.fused_length = 2;
+    } else if(second == operation1 && find_skip_jump(first, false) != nullptr) {
+        entry.fused = find_skip_jump(first, false);
+        entry.fused_length = 2;
+    } else if(first == opF_func7 && is_decoded(cache, index + 4) && cache.entries[index + 4].func == operation1 && find_skip_jump(second, true) != nullptr) {
+        entry.fused = find_skip_jump(second, true);
+        entry.fused_length = 3;
+    }
+}
+
+void decode(Machine& machine, const int index) {
+    const uint16_t opcode = machine.fetch_opcode(index);
+    
+    auto& entry = machine.decode_cache->entries[index];
+    entry.func = resolve_handler(opcode, machine.decode_cache->quirks);
+    entry.instruction = decode_operands(opcode);
+}
+
+void decode_and_execute(Machine& machine, const Instruction&) {
+    const int index = machine.state.PC & 0xfff;
+    
+    decode(machine, index);
+    fuse(*machine.decode_cache, index);
+    
+    const auto& entry = machine.decode_cache->entries[index];
+    entry.func(machine, entry.instruction);
 }
 
-void save_state() {
+// decodes and fuses all of memory in one go, so sequences are found before they ever run
+void predecode(Machine& machine) {
+    for(int i = 0; i < 4096; i++)
+        decode(machine, i);
+    
+    for(int i = 0; i < 4096; i++)
+        fuse(*machine.decode_cache, i);
+}
+
+void drop_decoded(DecodeCache& cache, const uint16_t address, const int length) {
+    // an instruction starting one byte before the write is also affected. I can point past memory, which still
+    // has to stay inside the cache
+    const int first = std::min(std::max(address - 1, 0), 4095);
+    const int last = std::min(address + length - 1, 4095);
+    
+    for(int i = first; i <= last; i++) {
+        cache.entries[i].func = decode_and_execute;
+        cache.entries[i].fused = nullptr;
+        cache.entries[i].fused_length = 0;
+    }
+    
+    // sequences running into the written range are split back up
+    for(int i = std::max(first - 4, 0); i < first; i++) {
+        if(i + cache.entries[i].fused_length * 2 > first) {
+            cache.entries[i].fused = nullptr;
+            cache.entries[i].fused_length = 0;
+        }
+    }
+}
+
+// decodes everything again when the options picked another quirk set since the last run
+void use_quirks(Machine& machine) {
+    const QuirkSet quirks = machine.options.quirks();
+    if(machine.decode_cache->quirks == quirks)
+        return;
+    
+    machine.decode_cache->quirks = quirks;
+    predecode(machine);
+}
+
+void Machine::step() {
+    use_quirks(*this);
+    
+    const auto& entry = decode_cache->entries[state.PC & 0xfff];
+    entry.func(*this, entry.instruction);
+}
+
+void interpret(Machine& machine, const uint64_t count) {
+    use_quirks(machine);
+    
+    const auto& entries = machine.decode_cache->entries;
+    
+    uint64_t executed = 0;
+    while(executed < count) {
+        const auto& entry = entries[machine.state.PC & 0xfff];
+        
+        // fused sequences only run when they can't overshoot count
+        if(entry.fused != nullptr && uint64_t(entry.fused_length) <= count - executed) {
+            executed += entry.fused(machine, &entry);
+        } else {
+            entry.func(machine, entry.instruction);
+            executed++;
+        }
+    }
+}
+
+#endif
+
+Machine::Machine() : decode_cache(std::make_unique<DecodeCache>()) {}
+
+Machine::~Machine() = default;
+
+Machine::Machine(Machine&& other) noexcept = default;
+Machine& Machine::operator=(Machine&& other) noexcept = default;
+
+void Machine::run(const uint64_t count) {
+#ifdef CHIP8_JIT
+    if(options.engine == Engine::JIT) {
+        if(jit == nullptr)
+            jit = std::make_unique<Jit>();
+        
+        jit->run(*this, count);
+        return;
+    }
+#endif
+    
+    interpret(*this, count);
+}
+
+void Machine::tick_timers() {
+    if(state.delay_timer > 0)
+        state.delay_timer--;
+    
+    if(state.sound_timer > 0)
+        state.sound_timer--;
+}
+
+void Machine::invalidate_decode_cache(const uint16_t address, const int length) {
+#ifdef CHIP8_DISPATCH_CACHED
+    drop_decoded(*decode_cache, address, length);
+#endif
+
+#ifdef CHIP8_JIT
+    if(jit != nullptr)
+        jit->invalidate(address, length);
+#endif
+    
+    if(disassembly != nullptr)
+        disassembly->invalidate(address, length);
+}
+
+const char* Machine::disassemble(const uint16_t address) {
+    if(disassembly == nullptr)
+        disassembly = std::make_unique<Disassembly>();
+    
+    return disassembly->at(state.memory, address);
+}
+
+void Machine::flush_decode_cache() {
+    invalidate_decode_cache(0, 4096);
+
+#ifdef CHIP8_DISPATCH_CACHED
+    predecode(*this);
+#endif
+}
+
+void Machine::reset() {
+    state.reset();
+    state.random_state = seed;
+    unimplemented_opcodes = 0;
+    sound_timer_writes = 0;
+    
+    memcpy(state.memory, chip8_fontset.data(), chip8_fontset.size());
+    
+    flush_decode_cache();
+}
+
+bool Machine::load_rom(const char* path) {
+    reset();
+    
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr)
+        return false;
+    
+    fseek(file, 0L, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+    
+    const bool read = size >= 0 && size <= max_rom_size && fread(state.memory + program_begin, 1, size, file) == size_t(size);
+    fclose(file);
+    
+    flush_decode_cache();
+    
+    return read;
+}
+
+bool Machine::load_rom(const uint8_t* data, const size_t size) {
+    reset();
+    
+    if(size > max_rom_size)
+        return false;
+    
+    memcpy(state.memory + program_begin, data, size);
+    
+    flush_decode_cache();
+    
+    return true;
+}
+
+void Machine::save_state() {
     stored_state = state;
 }
 
-void load_state() {
+void Machine::load_state() {
     state = stored_state;
+    state.mark_rows_dirty(0, hires_screen_height);
+    
+    flush_decode_cache();
 }
@@ -1,17 +1,28 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 
 // chip-8 constants
 constexpr int screen_width = 64;
 constexpr int screen_height = 32;
+
+// schip high resolution mode
+constexpr int hires_screen_width = 128;
+constexpr int hires_screen_height = 64;
 constexpr int program_begin = 0x200;
+
+// everything from program_begin to the end of memory
+constexpr int max_rom_size = 4096 - program_begin;
 constexpr int stack_size = 16;
 
 inline int to_coord(int x, int y) {
     return (y * screen_width) + x;
 }
 
+static_assert(screen_width == 64 && hires_screen_width == 128, "framebuffer rows are one word, or two in hires");
+
 struct EmulatorState {
     void reset() {
         for(int i = 0; i < 4096; i++)
@@ -32,15 +43,28 @@ struct EmulatorState {
         delay_timer = 0;
         sound_timer = 0;
         
-        for(int y = 0; y < screen_height; y++) {
-            for(int x = 0; x < screen_width; x++) {
-                pixels[to_coord(x, y)] = 0;
-            }
+        hires = false;
+        
+        for(int y = 0; y < hires_screen_height; y++) {
+            framebuffer[y][0] = 0;
+            framebuffer[y][1] = 0;
         }
         
+        mark_rows_dirty(0, hires_screen_height);
         draw_dirty = true;
     }
     
+    // grows the dirty span to cover rows begin to end
+    void mark_rows_dirty(const int begin, const int end) {
+        if(dirty_begin == dirty_end) {
+            dirty_begin = begin;
+            dirty_end = end;
+        } else {
+            dirty_begin = begin < dirty_begin ? begin : dirty_begin;
+            dirty_end = end > dirty_end ? end : dirty_end;
+        }
+    }
+    
     uint8_t memory[4096] = {};
     uint16_t PC = program_begin;
     
@@ -53,25 +77,166 @@ struct EmulatorState {
     
     uint8_t delay_timer = 0, sound_timer = 0;
     
-    uint8_t pixels[screen_width * screen_height] = {};
+    // xorshift state for CXNN, reset() leaves it alone so machines can be seeded
+    uint32_t random_state = 1;
+    
+    // the active resolution
+    int width() const {
+        return hires ? hires_screen_width : screen_width;
+    }
+    
+    int height() const {
+        return hires ? hires_screen_height : screen_height;
+    }
+    
+    bool hires = false;
+    
+    // the left and right word of each row, the leftmost pixel is the top bit.
+    // low resolution only uses the left word of the first 32 rows.
+    uint64_t framebuffer[hires_screen_height][2] = {};
     bool draw_dirty = false;
     
+    // rows changed since the renderer last uploaded them, empty when they're equal.
+    // this keeps growing while anti-flicker holds draw_dirty off, the renderer clears it after uploading.
+    int dirty_begin = 0, dirty_end = hires_screen_height;
+    
     bool keys[16] = {};
 };
 
+enum class Engine {
+    Interpreter,
+    JIT
+};
+
+// behaviour that differs between interpreters, the handlers are compiled once for every combination with these as
+// constants so they never check options per instruction. the profiles roms are written for only differ in
+// quirk_increment_index so far: the COSMAC VIP moves I, SCHIP and modern interpreters leave it alone.
+typedef uint8_t QuirkSet;
+constexpr QuirkSet quirk_increment_index = 1 << 0; // FX55/FX65 leave I after the last register
+constexpr QuirkSet quirk_anti_flicker = 1 << 1;    // a collision holds the frame back until the next draw
+constexpr int quirk_set_count = 1 << 2;
+
 struct EmuOptions {
     bool enable_anti_flicker = true;
     bool emulate_original = false;
+    
+    Engine engine = Engine::Interpreter;
+    
+    // the quirk set these pick, looked at once per run
+    QuirkSet quirks() const {
+        return (emulate_original ? quirk_increment_index : 0) | (enable_anti_flicker ? quirk_anti_flicker : 0);
+    }
 };
 
-inline EmuOptions options;
+// an opcode with its operands already extracted
+struct Instruction {
+    uint16_t opcode = 0;
+    uint16_t nnn = 0;
+    uint8_t x = 0, y = 0, n = 0, nn = 0;
+};
+
+constexpr Instruction decode_operands(const uint16_t opcode) {
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.nnn = opcode & 0x0fff;
+    instruction.x = (opcode & 0x0f00) >> 8;
+    instruction.y = (opcode & 0x00f0) >> 4;
+    instruction.n = opcode & 0x000f;
+    instruction.nn = opcode & 0x00ff;
+    
+    return instruction;
+}
+
+// unpacks the framebuffer to one byte per pixel (0 or 1), width() by height() of them, for the renderer
+void expand_framebuffer(const EmulatorState& state, uint8_t* pixels);
+
+// packed 1 bit per pixel instead, for the renderer to unpack. each row becomes framebuffer_row_texels 32-bit
+// words with the leftmost pixel at the top bit of the first, the same in either resolution.
+constexpr int framebuffer_row_texels = hires_screen_width / 32;
+void pack_framebuffer_rows(const EmulatorState& state, uint32_t* texels, const int begin, const int end);
 
-inline bool pause_execution = false;
+struct Machine;
 
-inline EmulatorState state;
-inline EmulatorState stored_state;
+typedef void (*cpu_func)(Machine& machine, const Instruction& instruction);
 
-void process_opcode(const uint16_t opcode);
+// which interpreter dispatch backend chip8-shared was built with (cached, switch, goto or constexpr)
+extern const char* const dispatch_backend;
 
-void save_state();
-void load_state();
+// the final handler for an opcode with quirks, with all of the nested dispatch tables already walked
+cpu_func resolve_handler(const uint16_t opcode, const QuirkSet quirks);
+
+// whatever the dispatch backend keeps around per machine
+struct DecodeCache;
+
+struct Disassembly;
+
+#ifdef CHIP8_JIT
+class Jit;
+#endif
+
+// a single chip-8 machine, any number of them can run side by side
+struct Machine {
+    Machine();
+    ~Machine();
+    
+    Machine(Machine&& other) noexcept;
+    Machine& operator=(Machine&& other) noexcept;
+    
+    // resets the emulator, reseeds CXNN and loads the font into memory
+    void reset();
+    
+    // fails without loading anything if the file doesn't fit between program_begin and the end of memory
+    bool load_rom(const char* path);
+    
+    // the same for a rom that's already in memory, like one in a RomPack
+    bool load_rom(const uint8_t* data, const size_t size);
+    
+    uint16_t fetch_opcode(const uint16_t address) const {
+        return (state.memory[address & 0xfff] << 8) | state.memory[(address + 1) & 0xfff];
+    }
+    
+    void process_opcode(const uint16_t opcode);
+    
+    // executes the instruction at PC, going through the decode cache
+    void step();
+    
+    // executes count instructions on the engine selected in options
+    void run(const uint64_t count);
+    
+    // decrements the delay and sound timers, 60 times a second
+    void tick_timers();
+    
+    // must be called whenever memory is changed outside of an opcode (loading a rom, poking memory, etc)
+    void invalidate_decode_cache(const uint16_t address, const int length);
+    void flush_decode_cache();
+    
+    // the instruction at address as assembly, cached until memory there changes
+    const char* disassemble(const uint16_t address);
+    
+    void save_state();
+    void load_state();
+    
+    EmulatorState state;
+    EmuOptions options;
+    
+    // CXNN produces the same numbers for the same seed, must be non-zero
+    uint32_t seed = 1;
+    
+    // how many times an opcode without a handler ran since the last reset, they're skipped without moving PC
+    uint64_t unimplemented_opcodes = 0;
+    
+    // how many times FX18 ran since the last reset, it's the only instruction that moves sound_timer
+    uint64_t sound_timer_writes = 0;
+    
+    EmulatorState stored_state;
+    
+    std::unique_ptr<DecodeCache> decode_cache;
+    
+    // created the first time something is disassembled
+    std::unique_ptr<Disassembly> disassembly;
+
+#ifdef CHIP8_JIT
+    // created the first time the jit engine runs
+    std::unique_ptr<Jit> jit;
+#endif
+};
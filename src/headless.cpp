@@ -0,0 +1,243 @@
+#include "headless.hpp"
+#include "emu.hpp"
+#include "disassembler.hpp"
+#include "beeper.hpp"
+#include "scheduler.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// a key going down or up at the start of a frame
+struct KeyEvent {
+    uint64_t frame = 0;
+    int key = 0;
+    bool pressed = false;
+};
+
+// one event per line, "<frame> <key in hex> <down|up>", # starts a comment
+bool load_key_script(const char* path, std::vector<KeyEvent>& events) {
+    std::ifstream file(path);
+    if(!file)
+        return false;
+    
+    std::string line;
+    while(std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        
+        std::istringstream stream(line);
+        
+        KeyEvent event;
+        std::string state;
+        if(!(stream >> event.frame >> std::hex >> event.key >> state))
+            continue;
+        
+        if(event.key < 0 || event.key > 0xF || (state != "down" && state != "up")) {
+            fprintf(stderr, "bad key script line: %s\n", line.c_str());
+            return false;
+        }
+        
+        event.pressed = state == "down";
+        events.push_back(event);
+    }
+    
+    std::stable_sort(events.begin(), events.end(), [](const KeyEvent& a, const KeyEvent& b) {
+        return a.frame < b.frame;
+    });
+    
+    return true;
+}
+
+void print_framebuffer(const EmulatorState& state) {
+    for(int y = 0; y < state.height(); y++) {
+        char row[hires_screen_width + 1] = {};
+        for(int x = 0; x < state.width(); x++)
+            row[x] = (state.framebuffer[y][x / 64] >> (63 - x % 64)) & 1 ? '#' : '.';
+        
+        printf("%s\n", row);
+    }
+}
+
+int run_disassemble(int argc, char* argv[]) {
+    if(argc < 1 || argc > 2) {
+        fprintf(stderr, "usage: chip8 --disassemble <rom> [output]\n");
+        return 1;
+    }
+    
+    FILE* out = stdout;
+    if(argc == 2) {
+        out = fopen(argv[1], "w");
+        if(out == nullptr) {
+            fprintf(stderr, "couldn't write to %s\n", argv[1]);
+            return 1;
+        }
+    }
+    
+    const bool read = disassemble_rom(argv[0], out);
+    
+    if(out != stdout)
+        fclose(out);
+    
+    if(!read) {
+        fprintf(stderr, "couldn't open %s\n", argv[0]);
+        return 1;
+    }
+    
+    return 0;
+}
+
+int run_headless(int argc, char* argv[]) {
+    // time to first instruction is counted from here, which is as close to process start as main gets
+    const auto start = std::chrono::steady_clock::now();
+    
+    const char* rom = nullptr;
+    const char* key_script = nullptr;
+    const char* wav = nullptr;
+    uint64_t cycles = 0, frames = 600, instructions_per_frame = 0;
+    Engine engine = Engine::Interpreter;
+    
+    for(int i = 0; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        
+        if(!strcmp(argv[i], "--cycles") && has_value) {
+            cycles = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--frames") && has_value) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--ipf") && has_value) {
+            instructions_per_frame = std::max<uint64_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+        } else if(!strcmp(argv[i], "--keys") && has_value) {
+            key_script = argv[++i];
+        } else if(!strcmp(argv[i], "--wav") && has_value) {
+            wav = argv[++i];
+        } else if(!strcmp(argv[i], "--jit")) {
+            engine = Engine::JIT;
+        } else if(argv[i][0] != '-' && rom == nullptr) {
+            rom = argv[i];
+        } else {
+            rom = nullptr;
+            break;
+        }
+    }
+    
+    if(rom == nullptr) {
+        fprintf(stderr, "usage: chip8 --headless <rom> [--cycles n | --frames n] [--ipf n] [--keys file] [--wav file] [--jit]\n");
+        return 1;
+    }
+    
+    std::vector<KeyEvent> key_events;
+    if(key_script != nullptr && !load_key_script(key_script, key_events)) {
+        fprintf(stderr, "couldn't load key script %s\n", key_script);
+        return 1;
+    }
+    
+    // frames run at the gui's default speed, and a cycle count is one frame unless --ipf splits it up, so
+    // measuring speed doesn't pay for a frame per instruction
+    if(instructions_per_frame == 0)
+        instructions_per_frame = cycles > 0 ? cycles : default_instructions_per_second / Scheduler::ticks_per_second;
+    
+    const uint64_t total = cycles > 0 ? cycles : frames * instructions_per_frame;
+    
+    Machine machine;
+    machine.options.engine = engine;
+    
+    if(!machine.load_rom(rom)) {
+        fprintf(stderr, "couldn't open %s\n", rom);
+        return 1;
+    }
+    
+    // with --wav the beeper is rendered as fast as it's written, instead of at the speed of an audio device
+    Beeper beeper(44100);
+    beeper.start_queued = 0;
+    beeper.max_queued = UINT64_MAX;
+    
+    std::vector<int16_t> audio;
+    
+    std::chrono::steady_clock::time_point first_instruction, run_start;
+    
+    uint64_t executed = 0, frame = 0;
+    auto next_event = key_events.begin();
+    
+    while(executed < total) {
+        for(; next_event != key_events.end() && next_event->frame <= frame; next_event++)
+            machine.state.keys[next_event->key] = next_event->pressed;
+        
+        machine.tick_timers();
+        
+        uint64_t count = std::min(instructions_per_frame, total - executed);
+        
+        // a frame's samples are split evenly between its instructions
+        const uint64_t frame_instructions = count;
+        const uint64_t first_sample = frame * beeper.sample_rate / 60, last_sample = (frame + 1) * beeper.sample_rate / 60;
+        uint64_t frame_executed = 0;
+        
+        auto run = [&](const uint64_t n) {
+            if(wav != nullptr) {
+                const uint64_t samples = last_sample - first_sample;
+                beeper.run(machine,
+                           n,
+                           first_sample + samples * frame_executed / frame_instructions,
+                           first_sample + samples * (frame_executed + n) / frame_instructions);
+            } else {
+                machine.run(n);
+            }
+            
+            frame_executed += n;
+        };
+        
+        if(wav != nullptr)
+            beeper.gate(machine.state.sound_timer > 0, first_sample);
+        
+        if(executed == 0) {
+            run(1);
+            
+            first_instruction = std::chrono::steady_clock::now();
+            run_start = first_instruction;
+            
+            executed++;
+            count--;
+        }
+        
+        run(count);
+        executed += count;
+        frame++;
+        
+        if(wav != nullptr) {
+            beeper.flush(last_sample);
+            
+            const size_t rendered = audio.size();
+            audio.resize(rendered + beeper.queued());
+            beeper.render(audio.data() + rendered, audio.size() - rendered);
+        }
+    }
+    
+    const auto end = std::chrono::steady_clock::now();
+    
+    print_framebuffer(machine.state);
+    
+    if(wav != nullptr && !write_wav(wav, audio, beeper.sample_rate)) {
+        fprintf(stderr, "couldn't write %s\n", wav);
+        return 1;
+    }
+    
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double run_seconds = std::chrono::duration<double>(end - run_start).count();
+    
+    printf("instructions: %llu\n", (unsigned long long)executed);
+    printf("frames: %llu\n", (unsigned long long)frame);
+    printf("PC: 0x%03X I: 0x%03X\n", machine.state.PC, machine.state.I);
+    printf("wall time: %.6f s\n", seconds);
+    
+    if(executed > 1 && run_seconds > 0.0)
+        printf("instructions per second: %.0f\n", (executed - 1) / run_seconds);
+    
+    if(executed > 0)
+        printf("time to first instruction: %.3f ms\n", std::chrono::duration<double, std::milli>(first_instruction - start).count());
+    
+    return 0;
+}
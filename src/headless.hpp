@@ -0,0 +1,9 @@
+#pragma once
+
+// runs a rom without initialising SDL or OpenGL, then prints the framebuffer and how fast it ran.
+// argv is everything after --headless: <rom> [--cycles n | --frames n] [--ipf n] [--keys file] [--wav file] [--jit]
+int run_headless(int argc, char* argv[]);
+
+// writes the disassembly of a rom to a file, or stdout without one.
+// argv is everything after --disassemble: <rom> [output]
+int run_disassemble(int argc, char* argv[]);
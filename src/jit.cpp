@@ -0,0 +1,615 @@
+#include "jit.hpp"
+#include "emu.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mman.h>
+
+// blocks are capped so invalidation only has to look a fixed distance back
+constexpr int max_block_instructions = 64;
+constexpr int max_block_bytes = max_block_instructions * 2;
+
+constexpr size_t code_arena_size = 4 * 1024 * 1024;
+
+// blocks get the machine for handler calls, its state which they address directly, and how many instructions
+// they may run. they return how many they did, jumps back into the block loop until the budget runs out
+typedef uint64_t (*block_func)(Machine* machine, EmulatorState* state, uint64_t budget);
+
+// the second opcode byte of the long form jumps
+constexpr uint8_t jump_equal = 0x84;
+constexpr uint8_t jump_not_equal = 0x85;
+constexpr uint8_t jump_above = 0x87;
+
+struct Block {
+    uint16_t start = 0, end = 0;
+    uint32_t instruction_count = 0;
+    block_func code = nullptr;
+    
+    // handlers called from the block get pointers into here
+    std::unique_ptr<Instruction[]> instructions;
+};
+
+class Emitter {
+public:
+    void byte(const uint8_t value) {
+        code.push_back(value);
+    }
+    
+    template<typename T>
+    void immediate(const T value) {
+        uint8_t bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        
+        code.insert(code.end(), bytes, bytes + sizeof(T));
+    }
+    
+    // all state accesses are [rbx + disp32]
+    void state_operand(const uint8_t reg, const size_t offset) {
+        byte(0x80 | (reg << 3) | 0x3);
+        immediate<int32_t>(offset);
+    }
+    
+    // mov byte [rbx + offset], imm8
+    void store_byte(const size_t offset, const uint8_t value) {
+        byte(0xC6);
+        state_operand(0, offset);
+        byte(value);
+    }
+    
+    // add byte [rbx + offset], imm8
+    void add_byte(const size_t offset, const uint8_t value) {
+        byte(0x80);
+        state_operand(0, offset);
+        byte(value);
+    }
+    
+    // mov word [rbx + offset], imm16
+    void store_word(const size_t offset, const uint16_t value) {
+        byte(0x66);
+        byte(0xC7);
+        state_operand(0, offset);
+        immediate(value);
+    }
+    
+    // movzx eax, byte [rbx + offset]
+    void load_al(const size_t offset) {
+        byte(0x0F);
+        byte(0xB6);
+        state_operand(0, offset);
+    }
+    
+    // <op> byte [rbx + offset], al, where op is mov (0x88), and (0x20) or xor (0x30)
+    void al_operation(const uint8_t op, const size_t offset) {
+        byte(op);
+        state_operand(0, offset);
+    }
+    
+    // cmp byte [rbx + offset], imm8
+    void compare_byte(const size_t offset, const uint8_t value) {
+        byte(0x80);
+        state_operand(7, offset);
+        byte(value);
+    }
+    
+    // cmp byte [rbx + rax + offset], imm8
+    void compare_indexed_byte(const size_t offset, const uint8_t value) {
+        byte(0x80);
+        byte(0xBC);
+        byte(0x03);
+        immediate<int32_t>(offset);
+        byte(value);
+    }
+    
+    // cmp al, byte [rbx + offset]
+    void compare_al(const size_t offset) {
+        byte(0x3A);
+        state_operand(0, offset);
+    }
+    
+    // r13 counts what ran in earlier passes through the block, less any instructions skipped over, so that
+    // wherever the code is it has executed r13 plus the instructions in front of it
+    // add r13, value
+    void add_executed(const int32_t value) {
+        byte(0x49);
+        byte(0x81);
+        byte(0xC5);
+        immediate(value);
+    }
+    
+    // lea rax, [r13 + value], cmp rax, r14 (the budget)
+    void compare_budget(const int32_t value) {
+        byte(0x49);
+        byte(0x8D);
+        byte(0x85);
+        immediate(value);
+        
+        byte(0x4C);
+        byte(0x39);
+        byte(0xF0);
+    }
+    
+    // jumps to *entry unless it's still null or there might not be budget for a whole block, otherwise to out.
+    // r13 has to count everything executed so far, the block jumped to starts its own count from there
+    void chain(const uint8_t* const* entry, const int out) {
+        compare_budget(max_block_instructions);
+        jump(out, jump_above);
+        
+        // mov rax, entry
+        byte(0x48);
+        byte(0xB8);
+        immediate(reinterpret_cast<uint64_t>(entry));
+        
+        // mov rax, [rax], test rax, rax
+        byte(0x48);
+        byte(0x8B);
+        byte(0x00);
+        byte(0x48);
+        byte(0x85);
+        byte(0xC0);
+        jump(out, jump_equal);
+        
+        // jmp rax
+        byte(0xFF);
+        byte(0xE0);
+    }
+    
+    int new_label() {
+        labels.push_back(0);
+        return labels.size() - 1;
+    }
+    
+    void bind(const int label) {
+        labels[label] = code.size();
+    }
+    
+    // jmp, or a conditional jump, to a label that's bound before or after
+    void jump(const int label, const uint8_t condition = 0) {
+        if(condition == 0) {
+            byte(0xE9);
+        } else {
+            byte(0x0F);
+            byte(condition);
+        }
+        
+        fixups.push_back({code.size(), label});
+        immediate<int32_t>(0);
+    }
+    
+    // fills in the jumps, once every label is bound
+    void resolve() {
+        for(const auto& fixup : fixups) {
+            const int32_t offset = labels[fixup.label] - (fixup.at + 4);
+            memcpy(code.data() + fixup.at, &offset, sizeof(offset));
+        }
+    }
+    
+    void call(const cpu_func func, const Instruction* instruction) {
+        // mov rdi, r12
+        byte(0x4C);
+        byte(0x89);
+        byte(0xE7);
+        
+        // mov rsi, instruction
+        byte(0x48);
+        byte(0xBE);
+        immediate(reinterpret_cast<uint64_t>(instruction));
+        
+        // mov rax, func
+        byte(0x48);
+        byte(0xB8);
+        immediate(reinterpret_cast<uint64_t>(func));
+        
+        // call rax
+        byte(0xFF);
+        byte(0xD0);
+    }
+    
+    void prologue() {
+        // push rbx, push r12, push r13, push r14, sub rsp 8, which keeps the stack 16 byte aligned for calls
+        byte(0x53);
+        byte(0x41);
+        byte(0x54);
+        byte(0x41);
+        byte(0x55);
+        byte(0x41);
+        byte(0x56);
+        byte(0x48);
+        byte(0x83);
+        byte(0xEC);
+        byte(0x08);
+        
+        // mov rbx, rsi (state)
+        byte(0x48);
+        byte(0x89);
+        byte(0xF3);
+        
+        // mov r12, rdi (machine)
+        byte(0x49);
+        byte(0x89);
+        byte(0xFC);
+        
+        // mov r14, rdx (budget)
+        byte(0x49);
+        byte(0x89);
+        byte(0xD6);
+        
+        // xor r13d, r13d
+        byte(0x45);
+        byte(0x31);
+        byte(0xED);
+    }
+    
+    // returns r13 plus the instructions executed in this pass
+    void epilogue(const int instruction_count) {
+        // mov eax, instruction_count
+        byte(0xB8);
+        immediate<int32_t>(instruction_count);
+        
+        // add rax, r13
+        byte(0x4C);
+        byte(0x01);
+        byte(0xE8);
+        
+        // add rsp 8, pop r14, pop r13, pop r12, pop rbx, ret
+        byte(0x48);
+        byte(0x83);
+        byte(0xC4);
+        byte(0x08);
+        byte(0x41);
+        byte(0x5E);
+        byte(0x41);
+        byte(0x5D);
+        byte(0x41);
+        byte(0x5C);
+        byte(0x5B);
+        byte(0xC3);
+    }
+    
+    std::vector<uint8_t> code;
+
+private:
+    struct Fixup {
+        size_t at = 0;
+        int label = 0;
+    };
+    
+    std::vector<size_t> labels;
+    std::vector<Fixup> fixups;
+};
+
+constexpr size_t v_offset(const int index) {
+    return offsetof(EmulatorState, v) + index;
+}
+
+// whether execution always falls through to the next instruction, which is what keeps a block going
+bool is_straight_line(const Instruction& instruction) {
+    switch(instruction.opcode >> 12) {
+        case 0x0:
+            // 00E0, 00CN, 00FB, 00FC, 00FE & 00FF, 00EE is the only one that jumps
+            return instruction.x == 0x0 && (instruction.nn == 0xE0 || (instruction.nn & 0xF0) == 0xC0 || (instruction.nn >= 0xFB && instruction.nn != 0xFD));
+        case 0x6:
+        case 0x7:
+        case 0xA:
+        case 0xC:
+        case 0xD:
+            return true;
+        case 0x8:
+            return instruction.n == 0x0 || (instruction.n >= 0x2 && instruction.n <= 0x6);
+        case 0xF:
+            switch(instruction.n) {
+                case 0x7:
+                case 0x8:
+                case 0x9:
+                case 0xE:
+                    return true;
+                case 0x5:
+                    return instruction.y == 0x6 || instruction.y == 0x1; // FX65 & FX15, FX55 writes memory
+            }
+            break;
+    }
+    
+    return false;
+}
+
+// skips go on to one of the next two instructions, so a block carries on past them with a jump for the other
+bool is_skip(const Instruction& instruction) {
+    switch(instruction.opcode >> 12) {
+        case 0x3:
+        case 0x4:
+        case 0x9:
+            return true;
+        case 0xE:
+            return instruction.nn == 0x9E || instruction.nn == 0xA1;
+    }
+    
+    return false;
+}
+
+Jit::Jit() {
+    void* arena = mmap(nullptr, code_arena_size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(arena != MAP_FAILED)
+        code_arena = static_cast<uint8_t*>(arena);
+}
+
+Jit::~Jit() {
+    if(code_arena != nullptr)
+        munmap(code_arena, code_arena_size);
+}
+
+void Jit::write_arena(const uint8_t* code, const size_t size) {
+    mprotect(code_arena, code_arena_size, PROT_READ | PROT_WRITE);
+    memcpy(code_arena + code_arena_used, code, size);
+    mprotect(code_arena, code_arena_size, PROT_READ | PROT_EXEC);
+    
+    code_arena_used += size;
+}
+
+Block* Jit::translate(Machine& machine, const uint16_t start) {
+    std::vector<Instruction> instructions;
+    
+    uint16_t address = start;
+    while(instructions.size() < max_block_instructions && address < 4095) {
+        instructions.push_back(decode_operands(machine.fetch_opcode(address)));
+        address += 2;
+        
+        if(!is_straight_line(instructions.back()) && !is_skip(instructions.back()))
+            break;
+    }
+    
+    auto block = std::make_unique<Block>();
+    block->start = start;
+    block->end = address;
+    block->instruction_count = instructions.size();
+    block->instructions = std::make_unique<Instruction[]>(instructions.size());
+    std::copy(instructions.begin(), instructions.end(), block->instructions.get());
+    
+    const uint32_t count = block->instruction_count;
+    
+    Emitter emitter;
+    emitter.prologue();
+    
+    const size_t body = emitter.code.size();
+    
+    // one label in front of every instruction and one after the last, for skips and loops to land on
+    std::vector<int> labels;
+    for(uint32_t i = 0; i <= count; i++)
+        labels.push_back(emitter.new_label());
+    
+    // the taken side of each skip, emitted after the block
+    struct TakenSkip {
+        int label = 0;
+        uint32_t index = 0;
+    };
+    
+    std::vector<TakenSkip> taken_skips;
+    
+    // PC in state is only written out when a handler needs it, or the block is left
+    bool pc_in_sync = true;
+    bool left = false;
+    
+    for(uint32_t i = 0; i < count; i++) {
+        const Instruction& instruction = block->instructions[i];
+        const uint16_t pc = start + i * 2;
+        
+        emitter.bind(labels[i]);
+        
+        switch(instruction.opcode >> 12) {
+            case 0x1:
+                emitter.store_word(offsetof(EmulatorState, PC), instruction.nnn);
+                
+                // a jump back into the block runs it again while there's budget for all of it
+                if(instruction.nnn >= start && instruction.nnn <= pc && (instruction.nnn - start) % 2 == 0) {
+                    const uint32_t target = (instruction.nnn - start) / 2;
+                    const int out_of_budget = emitter.new_label();
+                    
+                    emitter.add_executed(i + 1 - target);
+                    emitter.compare_budget(count);
+                    emitter.jump(out_of_budget, jump_above);
+                    emitter.jump(labels[target]);
+                    
+                    emitter.bind(out_of_budget);
+                    emitter.epilogue(target);
+                } else {
+                    const int unchained = emitter.new_label();
+                    
+                    emitter.add_executed(i + 1);
+                    emitter.chain(&entries[instruction.nnn], unchained);
+                    
+                    emitter.bind(unchained);
+                    emitter.epilogue(0);
+                }
+                
+                left = true;
+                continue;
+            case 0x3:
+            case 0x4:
+            {
+                const int taken = emitter.new_label();
+                emitter.compare_byte(v_offset(instruction.x), instruction.nn);
+                emitter.jump(taken, (instruction.opcode >> 12) == 0x3 ? jump_equal : jump_not_equal);
+                
+                taken_skips.push_back({taken, i});
+                pc_in_sync = false;
+                continue;
+            }
+            case 0x9:
+            {
+                const int taken = emitter.new_label();
+                emitter.load_al(v_offset(instruction.y));
+                emitter.compare_al(v_offset(instruction.x));
+                emitter.jump(taken, jump_not_equal);
+                
+                taken_skips.push_back({taken, i});
+                pc_in_sync = false;
+                continue;
+            }
+            case 0xE:
+            {
+                if(!is_skip(instruction))
+                    break;
+                
+                // EX9E skips when the key is down, EXA1 when it's up
+                const int taken = emitter.new_label();
+                emitter.load_al(v_offset(instruction.x));
+                emitter.compare_indexed_byte(offsetof(EmulatorState, keys), instruction.nn == 0x9E ? 1 : 0);
+                emitter.jump(taken, jump_equal);
+                
+                taken_skips.push_back({taken, i});
+                pc_in_sync = false;
+                continue;
+            }
+            case 0x6:
+                emitter.store_byte(v_offset(instruction.x), instruction.nn);
+                pc_in_sync = false;
+                continue;
+            case 0x7:
+                emitter.add_byte(v_offset(instruction.x), instruction.nn);
+                pc_in_sync = false;
+                continue;
+            case 0xA:
+                emitter.store_word(offsetof(EmulatorState, I), instruction.nnn);
+                pc_in_sync = false;
+                continue;
+            case 0x8:
+            {
+                constexpr std::array<uint8_t, 4> al_ops = {0x88, 0x00, 0x20, 0x30};
+                
+                if(instruction.n == 0x0 || instruction.n == 0x2 || instruction.n == 0x3) {
+                    emitter.load_al(v_offset(instruction.y));
+                    emitter.al_operation(al_ops[instruction.n], v_offset(instruction.x));
+                    pc_in_sync = false;
+                    continue;
+                }
+            }
+                break;
+            case 0xF:
+                // FX07 and FX15 only copy a byte, FX18 goes through its handler to be counted for the beeper
+                if(instruction.n == 0x7) {
+                    emitter.load_al(offsetof(EmulatorState, delay_timer));
+                    emitter.al_operation(0x88, v_offset(instruction.x));
+                    pc_in_sync = false;
+                    continue;
+                } else if(instruction.n == 0x5 && instruction.y == 0x1) {
+                    emitter.load_al(v_offset(instruction.x));
+                    emitter.al_operation(0x88, offsetof(EmulatorState, delay_timer));
+                    pc_in_sync = false;
+                    continue;
+                }
+                break;
+        }
+        
+        if(!pc_in_sync)
+            emitter.store_word(offsetof(EmulatorState, PC), pc);
+        
+        emitter.call(resolve_handler(instruction.opcode, quirks), &instruction);
+        
+        // handlers always leave PC pointing at whatever runs next
+        pc_in_sync = true;
+        
+        if(!is_straight_line(instruction)) {
+            emitter.epilogue(i + 1);
+            left = true;
+        }
+    }
+    
+    // the block was cut short by the length limit
+    if(!left && !pc_in_sync)
+        emitter.store_word(offsetof(EmulatorState, PC), block->end);
+    
+    emitter.bind(labels[count]);
+    emitter.epilogue(count);
+    
+    // a taken skip lands two instructions on, with one fewer executed than the code it jumps to assumes
+    for(const auto& skip : taken_skips) {
+        const uint32_t target = skip.index + 2;
+        
+        emitter.bind(skip.label);
+        emitter.store_word(offsetof(EmulatorState, PC), start + target * 2);
+        
+        if(target <= count) {
+            emitter.add_executed(-1);
+            emitter.jump(labels[target]);
+        } else {
+            emitter.epilogue(skip.index + 1);
+        }
+    }
+    
+    emitter.resolve();
+    
+    if(code_arena_used + emitter.code.size() > code_arena_size) {
+        // nothing can be running while translating, so the whole arena can be recycled
+        flush();
+        code_arena_used = 0;
+    }
+    
+    block->code = reinterpret_cast<block_func>(code_arena + code_arena_used);
+    entries[start] = code_arena + code_arena_used + body;
+    write_arena(emitter.code.data(), emitter.code.size());
+    
+    blocks[start] = std::move(block);
+    
+    return blocks[start].get();
+}
+
+void Jit::invalidate(const uint16_t address, const int length) {
+    const int first = std::max(address - max_block_bytes, 0);
+    const int last = std::min(address + length, 4096);
+    
+    for(int i = first; i < last; i++) {
+        if(blocks[i] != nullptr && blocks[i]->end > address && blocks[i]->start < address + length) {
+            blocks[i].reset();
+            entries[i] = nullptr;
+        }
+    }
+}
+
+void Jit::flush() {
+    for(auto& block : blocks)
+        block.reset();
+    
+    entries.fill(nullptr);
+}
+
+void Jit::run(Machine& machine, const uint64_t count) {
+    EmulatorState& state = machine.state;
+    
+    // blocks call the handlers for one quirk set
+    if(machine.options.quirks() != quirks) {
+        flush();
+        quirks = machine.options.quirks();
+    }
+    
+    if(code_arena == nullptr) {
+        for(uint64_t i = 0; i < count; i++)
+            machine.step();
+        
+        return;
+    }
+    
+    uint64_t executed = 0;
+    while(executed < count) {
+        // out of range addresses, and blocks that would overshoot count go through the interpreter
+        if(state.PC >= 4095) {
+            machine.step();
+            executed++;
+            continue;
+        }
+        
+        Block* block = blocks[state.PC].get();
+        if(block == nullptr)
+            block = translate(machine, state.PC);
+        
+        if(block->instruction_count > count - executed) {
+            machine.step();
+            executed++;
+            continue;
+        }
+        
+        executed += block->code(&machine, &state, count - executed);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <memory>
+
+#include "emu.hpp"
+
+// only available when chip8-shared is built with CHIP8_JIT (x86-64 unix hosts)
+// translates basic blocks into native x86-64 code that works on state directly, and falls back to the
+// interpreter for anything it can't run as a whole block. results match the interpreter exactly.
+// skips stay inside a block, jumps back into it loop in native code and jumps elsewhere go straight to the
+// block there, as long as the instruction budget lasts.
+
+struct Machine;
+struct Block;
+
+// every machine running on the jit owns one of these, translated code is tied to that machine
+class Jit {
+public:
+    Jit();
+    ~Jit();
+    
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+    
+    // executes count instructions, same contract as Machine::run()
+    void run(Machine& machine, const uint64_t count);
+    
+    // drops blocks overlapping the written range
+    void invalidate(const uint16_t address, const int length);
+    
+    // drops every translated block
+    void flush();
+
+private:
+    Block* translate(Machine& machine, const uint16_t start);
+    void write_arena(const uint8_t* code, const size_t size);
+    
+    std::array<std::unique_ptr<Block>, 4096> blocks;
+    
+    // where each translated block's code carries on after its prologue, blocks jumping out go straight there
+    std::array<const uint8_t*, 4096> entries = {};
+    
+    // the quirk set blocks were translated for
+    QuirkSet quirks = 0;
+    
+    uint8_t* code_arena = nullptr;
+    size_t code_arena_used = 0;
+};
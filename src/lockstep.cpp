@@ -0,0 +1,789 @@
+#include "lockstep.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__)
+constexpr int lane_width = 32;
+const char* const lockstep_isa = "avx2";
+#elif defined(__SSE2__)
+constexpr int lane_width = 16;
+const char* const lockstep_isa = "sse";
+#else
+constexpr int lane_width = 8;
+const char* const lockstep_isa = "scalar";
+#endif
+
+// one byte per lane, the compiler picks the instructions for whatever the target supports
+typedef uint8_t lane_vector __attribute__((vector_size(lane_width)));
+
+struct LaneBlock {
+    lane_vector v[16] = {};
+    lane_vector delay_timer = {}, sound_timer = {};
+    lane_vector draw_dirty = {};
+    lane_vector keys[16] = {};
+    lane_vector hires = {};
+    lane_vector pixels[hires_screen_width * hires_screen_height] = {};
+    
+    // 0xFF for lanes in the group that's running, full_mask has every lane that exists
+    lane_vector mask = {}, full_mask = {};
+    
+    // which lanes took a skip
+    lane_vector skip = {};
+};
+
+lane_vector splat(const uint8_t value) {
+    return lane_vector{} + value;
+}
+
+// a where mask is set, b everywhere else
+lane_vector blend(const lane_vector mask, const lane_vector a, const lane_vector b) {
+    return (a & mask) | (b & ~mask);
+}
+
+// comparisons give 0xFF or 0x00 per lane, just typed as signed
+template<typename T>
+lane_vector as_mask(const T comparison) {
+    return reinterpret_cast<const lane_vector&>(comparison);
+}
+
+// pixels are laid out at the hires size, low resolution only uses the top left corner
+int pixel_coord(const int x, const int y) {
+    return y * hires_screen_width + x;
+}
+
+// moves the pixels of the lanes in mask by dx, dy on a width x height screen, what scrolls in is blank
+void shift_pixels(lane_vector* pixels, const lane_vector mask, const int width, const int height, const int dx, const int dy) {
+    for(int i = 0; i < height; i++) {
+        const int y = dy > 0 ? height - 1 - i : i;
+        
+        for(int j = 0; j < width; j++) {
+            const int x = dx > 0 ? width - 1 - j : j;
+            const int from_x = x - dx, from_y = y - dy;
+            
+            const bool inside = from_x >= 0 && from_x < width && from_y >= 0 && from_y < height;
+            const lane_vector moved = inside ? pixels[pixel_coord(from_x, from_y)] : lane_vector{};
+            
+            lane_vector& pixel = pixels[pixel_coord(x, y)];
+            pixel = blend(mask, moved, pixel);
+        }
+    }
+}
+
+uint8_t& byte_of(lane_vector& vector, const int lane) {
+    return reinterpret_cast<uint8_t*>(&vector)[lane % lane_width];
+}
+
+uint8_t byte_of(const lane_vector& vector, const int lane) {
+    return reinterpret_cast<const uint8_t*>(&vector)[lane % lane_width];
+}
+
+Lockstep::Lockstep(const int lane_count) : lanes(std::max(lane_count, 1)) {
+    blocks.resize((lanes + lane_width - 1) / lane_width);
+    
+    pc.resize(lanes);
+    index.resize(lanes);
+    memory.resize(lanes);
+    stack.resize(lanes);
+    stack_pointer.resize(lanes);
+    random_state.resize(lanes);
+    
+    for(int lane = 0; lane < lanes; lane++)
+        byte_of(blocks[lane / lane_width].full_mask, lane) = 0xFF;
+    
+    for(auto& block : blocks)
+        block.mask = block.full_mask;
+    
+    full_group.all = true;
+    full_group.first_block = 0;
+    full_group.last_block = blocks.size() - 1;
+    
+    group_of_opcode.resize(65536, -1);
+    
+    const EmulatorState initial;
+    for(int lane = 0; lane < lanes; lane++)
+        write_lane(lane, initial);
+    
+    refresh_divergent();
+}
+
+Lockstep::~Lockstep() = default;
+
+bool Lockstep::load_rom(const char* path) {
+    Machine machine;
+    machine.options = options;
+    machine.seed = seed;
+    
+    if(!machine.load_rom(path))
+        return false;
+    
+    for(int lane = 0; lane < lanes; lane++)
+        write_lane(lane, machine.state);
+    
+    refresh_divergent();
+    converged = false;
+    
+    return true;
+}
+
+EmulatorState Lockstep::get_lane(const int lane) const {
+    const LaneBlock& block = blocks[lane / lane_width];
+    
+    EmulatorState state;
+    memcpy(state.memory, memory[lane].data(), sizeof(state.memory));
+    state.PC = pc[lane];
+    std::copy(stack[lane].begin(), stack[lane].end(), state.stack);
+    state.stack_pointer = stack_pointer[lane];
+    state.I = index[lane];
+    
+    for(int i = 0; i < 16; i++) {
+        state.v[i] = byte_of(block.v[i], lane);
+        state.keys[i] = byte_of(block.keys[i], lane);
+    }
+    
+    state.delay_timer = byte_of(block.delay_timer, lane);
+    state.sound_timer = byte_of(block.sound_timer, lane);
+    state.random_state = random_state[lane];
+    
+    state.hires = byte_of(block.hires, lane);
+    
+    for(int y = 0; y < hires_screen_height; y++) {
+        for(int x = 0; x < hires_screen_width; x++)
+            state.framebuffer[y][x / 64] |= uint64_t(byte_of(block.pixels[pixel_coord(x, y)], lane) & 1) << (63 - x % 64);
+    }
+    
+    state.draw_dirty = byte_of(block.draw_dirty, lane);
+    
+    return state;
+}
+
+void Lockstep::set_lane(const int lane, const EmulatorState& state) {
+    write_lane(lane, state);
+    
+    refresh_divergent();
+    converged = false;
+}
+
+void Lockstep::write_lane(const int lane, const EmulatorState& state) {
+    LaneBlock& block = blocks[lane / lane_width];
+    
+    memcpy(memory[lane].data(), state.memory, sizeof(state.memory));
+    pc[lane] = state.PC;
+    std::copy(state.stack, state.stack + stack_size, stack[lane].begin());
+    stack_pointer[lane] = state.stack_pointer;
+    index[lane] = state.I;
+    
+    for(int i = 0; i < 16; i++) {
+        byte_of(block.v[i], lane) = state.v[i];
+        byte_of(block.keys[i], lane) = state.keys[i];
+    }
+    
+    byte_of(block.delay_timer, lane) = state.delay_timer;
+    byte_of(block.sound_timer, lane) = state.sound_timer;
+    random_state[lane] = state.random_state;
+    
+    byte_of(block.hires, lane) = state.hires ? 0xFF : 0;
+    
+    for(int y = 0; y < hires_screen_height; y++) {
+        for(int x = 0; x < hires_screen_width; x++)
+            byte_of(block.pixels[pixel_coord(x, y)], lane) = (state.framebuffer[y][x / 64] >> (63 - x % 64)) & 1;
+    }
+    
+    byte_of(block.draw_dirty, lane) = state.draw_dirty;
+}
+
+void Lockstep::set_key(const int lane, const int key, const bool pressed) {
+    byte_of(blocks[lane / lane_width].keys[key & 0xF], lane) = pressed;
+}
+
+void Lockstep::tick_timers() {
+    for(auto& block : blocks) {
+        block.delay_timer -= as_mask(block.delay_timer != 0) & splat(1);
+        block.sound_timer -= as_mask(block.sound_timer != 0) & splat(1);
+    }
+}
+
+void Lockstep::run(const uint64_t count) {
+    for(uint64_t i = 0; i < count; i++)
+        step();
+}
+
+uint16_t Lockstep::fetch_opcode(const int lane) const {
+    const uint16_t address = pc[lane];
+    
+    return (memory[lane][address & 0xfff] << 8) | memory[lane][(address + 1) & 0xfff];
+}
+
+uint8_t& Lockstep::lane_register(const int lane, const int index) {
+    return byte_of(blocks[lane / lane_width].v[index], lane);
+}
+
+bool Lockstep::check_converged() const {
+    const uint16_t first = pc[0];
+    for(int lane = 1; lane < lanes; lane++) {
+        if(pc[lane] != first)
+            return false;
+    }
+    
+    if(divergent[first & 0xfff] || divergent[(first + 1) & 0xfff]) {
+        const uint16_t opcode = fetch_opcode(0);
+        
+        for(int lane = 1; lane < lanes; lane++) {
+            if(fetch_opcode(lane) != opcode)
+                return false;
+        }
+    }
+    
+    return true;
+}
+
+void Lockstep::update_divergent(const uint16_t address, const int length) {
+    for(int i = 0; i < length; i++) {
+        const int byte = (address + i) & 0xfff;
+        
+        divergent[byte] = false;
+        for(int lane = 1; lane < lanes; lane++) {
+            if(memory[lane][byte] != memory[0][byte]) {
+                divergent[byte] = true;
+                break;
+            }
+        }
+    }
+}
+
+void Lockstep::refresh_divergent() {
+    update_divergent(0, 4096);
+}
+
+void Lockstep::step() {
+    // lanes that have been together can still reach code they wrote differently
+    if(!converged || divergent[pc[0] & 0xfff] || divergent[(pc[0] + 1) & 0xfff])
+        converged = check_converged();
+    
+    if(converged) {
+        converged_steps++;
+        
+        if(!masks_full) {
+            for(auto& block : blocks)
+                block.mask = block.full_mask;
+            
+            masks_full = true;
+        }
+        
+        execute(decode_operands(fetch_opcode(0)), full_group);
+        return;
+    }
+    
+    divergent_steps++;
+    
+    // lanes at the same opcode can run together, even at different addresses since every operand is per lane
+    size_t group_count = 0;
+    for(int lane = 0; lane < lanes; lane++) {
+        const uint16_t opcode = fetch_opcode(lane);
+        
+        int& group = group_of_opcode[opcode];
+        if(group < 0) {
+            group = group_count++;
+            
+            if(groups.size() < group_count)
+                groups.emplace_back();
+            
+            groups[group].opcode = opcode;
+            groups[group].lanes.clear();
+        }
+        
+        groups[group].lanes.push_back(lane);
+    }
+    
+    masks_full = false;
+    
+    for(size_t i = 0; i < group_count; i++) {
+        Group& group = groups[i];
+        group_of_opcode[group.opcode] = -1;
+        
+        group.first_block = group.lanes.front() / lane_width;
+        group.last_block = group.lanes.back() / lane_width;
+        
+        for(int block = group.first_block; block <= group.last_block; block++)
+            blocks[block].mask = lane_vector{};
+        
+        for(const int lane : group.lanes)
+            byte_of(blocks[lane / lane_width].mask, lane) = 0xFF;
+        
+        execute(decode_operands(group.opcode), group);
+    }
+}
+
+template<typename F>
+void Lockstep::each_lane(const Group& group, F f) {
+    if(group.all) {
+        for(int lane = 0; lane < lanes; lane++)
+            f(lane);
+    } else {
+        for(const int lane : group.lanes)
+            f(lane);
+    }
+}
+
+template<typename F>
+void Lockstep::each_block(const Group& group, F f) {
+    for(int block = group.first_block; block <= group.last_block; block++)
+        f(blocks[block]);
+}
+
+void Lockstep::execute(const Instruction& instruction, const Group& group) {
+    const uint8_t x = instruction.x;
+    const uint8_t y = instruction.y;
+    
+    auto next = [&] {
+        each_lane(group, [&](const int lane) {
+            pc[lane] += 2;
+        });
+    };
+    
+    // lanes where block.skip is set jump over the next instruction, which splits the group up
+    auto skip_next = [&] {
+        each_lane(group, [&](const int lane) {
+            pc[lane] += 2 + (byte_of(blocks[lane / lane_width].skip, lane) & 2);
+        });
+        
+        converged = false;
+    };
+    
+    // no PC change, counted per lane the same as null_func
+    auto unimplemented = [&] {
+        each_lane(group, [&](const int) {
+            unimplemented_opcodes++;
+        });
+    };
+    
+    // lanes can be in different resolutions, each one scrolls within its own
+    auto scroll = [&](const int dx, const int dy) {
+        each_block(group, [&](LaneBlock& block) {
+            shift_pixels(block.pixels, block.mask & ~block.hires, screen_width, screen_height, dx, dy);
+            shift_pixels(block.pixels, block.mask & block.hires, hires_screen_width, hires_screen_height, dx, dy);
+            
+            block.draw_dirty = blend(block.mask, splat(1), block.draw_dirty);
+        });
+        
+        next();
+    };
+    
+    switch(instruction.opcode >> 12) {
+        case 0x0:
+            if(instruction.x != 0) {
+                unimplemented();
+                break;
+            }
+            
+            switch(instruction.nn) {
+                case 0xE0: // 00E0
+                    each_block(group, [&](LaneBlock& block) {
+                        for(auto& pixel : block.pixels)
+                            pixel &= ~block.mask;
+                        
+                        block.draw_dirty = blend(block.mask, splat(1), block.draw_dirty);
+                    });
+                    
+                    next();
+                    break;
+                case 0xEE: // 00EE, lanes may have been called from different places
+                    each_lane(group, [&](const int lane) {
+                        stack_pointer[lane]--;
+                        pc[lane] = stack[lane][stack_pointer[lane] & (stack_size - 1)] + 2;
+                    });
+                    
+                    converged = false;
+                    break;
+                case 0xFB: // 00FB
+                    scroll(4, 0);
+                    break;
+                case 0xFC: // 00FC
+                    scroll(-4, 0);
+                    break;
+                case 0xFE: // 00FE & 00FF, switching resolution clears the screen
+                case 0xFF:
+                    each_block(group, [&](LaneBlock& block) {
+                        for(auto& pixel : block.pixels)
+                            pixel &= ~block.mask;
+                        
+                        block.hires = blend(block.mask, splat(instruction.n == 0xF ? 0xFF : 0), block.hires);
+                        block.draw_dirty = blend(block.mask, splat(1), block.draw_dirty);
+                    });
+                    
+                    next();
+                    break;
+                default:
+                    if((instruction.nn & 0xF0) == 0xC0) // 00CN
+                        scroll(0, instruction.n);
+                    else
+                        unimplemented();
+                    break;
+            }
+            break;
+        case 0x1: // 1NNN
+            each_lane(group, [&](const int lane) {
+                pc[lane] = instruction.nnn;
+            });
+            break;
+        case 0x2: // 2NNN
+            each_lane(group, [&](const int lane) {
+                stack[lane][stack_pointer[lane] & (stack_size - 1)] = pc[lane];
+                stack_pointer[lane]++;
+                pc[lane] = instruction.nnn;
+            });
+            break;
+        case 0x3: // 3XNN
+            each_block(group, [&](LaneBlock& block) {
+                block.skip = as_mask(block.v[x] == splat(instruction.nn));
+            });
+            
+            skip_next();
+            break;
+        case 0x4: // 4XNN
+            each_block(group, [&](LaneBlock& block) {
+                block.skip = as_mask(block.v[x] != splat(instruction.nn));
+            });
+            
+            skip_next();
+            break;
+        case 0x6: // 6XNN
+            each_block(group, [&](LaneBlock& block) {
+                block.v[x] = blend(block.mask, splat(instruction.nn), block.v[x]);
+            });
+            
+            next();
+            break;
+        case 0x7: // 7XNN
+            each_block(group, [&](LaneBlock& block) {
+                block.v[x] += splat(instruction.nn) & block.mask;
+            });
+            
+            next();
+            break;
+        case 0x8:
+            switch(instruction.n) {
+                case 0x0: // 8XY0
+                    each_block(group, [&](LaneBlock& block) {
+                        block.v[x] = blend(block.mask, block.v[y], block.v[x]);
+                    });
+                    break;
+                case 0x2: // 8XY2
+                    each_block(group, [&](LaneBlock& block) {
+                        block.v[x] &= block.v[y] | ~block.mask;
+                    });
+                    break;
+                case 0x3: // 8XY3
+                    each_block(group, [&](LaneBlock& block) {
+                        block.v[x] ^= block.v[y] & block.mask;
+                    });
+                    break;
+                case 0x4: // 8XY4, with the same carry check as op8_func4
+                    each_block(group, [&](LaneBlock& block) {
+                        const lane_vector carry = as_mask(block.v[y] < splat(0xFF) - block.v[x]) & splat(1);
+                        block.v[0xF] = blend(block.mask, carry, block.v[0xF]);
+                        block.v[x] += block.v[y] & block.mask;
+                    });
+                    break;
+                case 0x5: // 8XY5
+                    each_block(group, [&](LaneBlock& block) {
+                        const lane_vector no_borrow = ~as_mask(block.v[y] > block.v[x]) & splat(1);
+                        block.v[0xF] = blend(block.mask, no_borrow, block.v[0xF]);
+                        block.v[x] -= block.v[y] & block.mask;
+                    });
+                    break;
+                case 0x6: // 8XY6
+                    each_block(group, [&](LaneBlock& block) {
+                        block.v[0xF] = blend(block.mask, block.v[x] & splat(1), block.v[0xF]);
+                        block.v[x] = blend(block.mask, block.v[x] >> 1, block.v[x]);
+                    });
+                    break;
+                default:
+                    unimplemented();
+                    return;
+            }
+            
+            next();
+            break;
+        case 0x9: // 9XY0
+            each_block(group, [&](LaneBlock& block) {
+                block.skip = as_mask(block.v[x] != block.v[y]);
+            });
+            
+            skip_next();
+            break;
+        case 0xA: // ANNN
+            each_lane(group, [&](const int lane) {
+                index[lane] = instruction.nnn;
+            });
+            
+            next();
+            break;
+        case 0xC: // CXNN
+            each_lane(group, [&](const int lane) {
+                uint32_t random = random_state[lane];
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+                random_state[lane] = random;
+                
+                lane_register(lane, x) = random & instruction.nn;
+            });
+            
+            next();
+            break;
+        case 0xD: // DXYN
+            draw(instruction, group);
+            
+            next();
+            break;
+        case 0xE:
+            if(instruction.nn != 0x9E && instruction.nn != 0xA1)
+                break;
+            
+            // EX9E & EXA1, keys are per lane so this is where inputs split lanes up
+            each_lane(group, [&](const int lane) {
+                LaneBlock& block = blocks[lane / lane_width];
+                const bool pressed = byte_of(block.keys[byte_of(block.v[x], lane) & 0xF], lane) != 0;
+                
+                byte_of(block.skip, lane) = pressed == (instruction.nn == 0x9E) ? 0xFF : 0x00;
+            });
+            
+            skip_next();
+            break;
+        case 0xF:
+            switch(instruction.n) {
+                case 0x3: // FX33
+                {
+                    bool same_address = true;
+                    each_lane(group, [&](const int lane) {
+                        const int decimal_rep = lane_register(lane, x);
+                        const uint16_t address = index[lane];
+                        
+                        memory[lane][address & 0xfff] = (decimal_rep % 1000) / 100;
+                        memory[lane][(address + 1) & 0xfff] = (decimal_rep % 100) / 10;
+                        memory[lane][(address + 2) & 0xfff] = decimal_rep % 10;
+                        
+                        same_address &= address == index[group.all ? 0 : group.lanes.front()];
+                        for(int i = 0; i < 3; i++)
+                            divergent[(address + i) & 0xfff] = true;
+                    });
+                    
+                    // the usual case, everyone wrote to the same place so it can be checked properly
+                    if(same_address)
+                        update_divergent(index[group.all ? 0 : group.lanes.front()], 3);
+                    
+                    // the store might have been over code
+                    converged = false;
+                    
+                    next();
+                }
+                    break;
+                case 0x5:
+                    switch(y) {
+                        case 0x6: // FX65
+                            each_lane(group, [&](const int lane) {
+                                for(int i = 0; i <= x; i++)
+                                    lane_register(lane, i) = memory[lane][(index[lane] + i) & 0xfff];
+                                
+                                if(options.emulate_original)
+                                    index[lane] += x + 1;
+                            });
+                            break;
+                        case 0x5: // FX55
+                        {
+                            bool same_address = true;
+                            each_lane(group, [&](const int lane) {
+                                const uint16_t address = index[lane];
+                                
+                                for(int i = 0; i <= x; i++) {
+                                    memory[lane][(address + i) & 0xfff] = lane_register(lane, i);
+                                    divergent[(address + i) & 0xfff] = true;
+                                }
+                                
+                                same_address &= address == index[group.all ? 0 : group.lanes.front()];
+                            });
+                            
+                            if(same_address)
+                                update_divergent(index[group.all ? 0 : group.lanes.front()], x + 1);
+                            
+                            if(options.emulate_original) {
+                                each_lane(group, [&](const int lane) {
+                                    index[lane] += x + 1;
+                                });
+                            }
+                            
+                            converged = false;
+                        }
+                            break;
+                        case 0x1: // FX15
+                            each_block(group, [&](LaneBlock& block) {
+                                block.delay_timer = blend(block.mask, block.v[x], block.delay_timer);
+                            });
+                            break;
+                        default:
+                            return;
+                    }
+                    
+                    next();
+                    break;
+                case 0x7: // FX07
+                    each_block(group, [&](LaneBlock& block) {
+                        block.v[x] = blend(block.mask, block.delay_timer, block.v[x]);
+                    });
+                    
+                    next();
+                    break;
+                case 0x8: // FX18
+                    each_block(group, [&](LaneBlock& block) {
+                        block.sound_timer = blend(block.mask, block.v[x], block.sound_timer);
+                    });
+                    
+                    next();
+                    break;
+                case 0x9: // FX29
+                    each_lane(group, [&](const int lane) {
+                        index[lane] = lane_register(lane, x) * 0x5;
+                    });
+                    
+                    next();
+                    break;
+                case 0xA: // FX0A, advances once for every key that's down like opF_funcA
+                    each_lane(group, [&](const int lane) {
+                        LaneBlock& block = blocks[lane / lane_width];
+                        
+                        for(int i = 0; i < 16; i++) {
+                            if(byte_of(block.keys[i], lane) != 0) {
+                                byte_of(block.v[x], lane) = i;
+                                pc[lane] += 2;
+                            }
+                        }
+                    });
+                    
+                    converged = false;
+                    break;
+                case 0xE: // FX1E
+                    each_lane(group, [&](const int lane) {
+                        lane_register(lane, 0xF) = (index[lane] + lane_register(lane, x)) > 0xFFF;
+                        index[lane] += lane_register(lane, x);
+                    });
+                    
+                    next();
+                    break;
+                default:
+                    unimplemented();
+                    break;
+            }
+            break;
+        default:
+            unimplemented();
+            break;
+    }
+}
+
+void Lockstep::draw(const Instruction& instruction, const Group& group) {
+    const int first = group.all ? 0 : group.lanes.front();
+    const uint8_t x_pos = lane_register(first, instruction.x);
+    const uint8_t y_pos = lane_register(first, instruction.y);
+    const uint16_t address = index[first];
+    const bool hires = byte_of(blocks[first / lane_width].hires, first) != 0;
+    
+    // the sprite size depends on the resolution, DXY0 is 16x16 in hires
+    auto sprite_size = [&](const bool lane_hires, int& rows, int& columns) {
+        const bool large = lane_hires && instruction.n == 0;
+        rows = large ? 16 : instruction.n;
+        columns = large ? 16 : 8;
+    };
+    
+    // a sprite row with its leftmost pixel in the top bit
+    auto sprite_row = [&](const int lane, const uint16_t start, const int columns, const int row) -> uint16_t {
+        if(columns == 16)
+            return (memory[lane][(start + row * 2) & 0xfff] << 8) | memory[lane][(start + row * 2 + 1) & 0xfff];
+        
+        return memory[lane][(start + row) & 0xfff] << 8;
+    };
+    
+    int rows, columns;
+    sprite_size(hires, rows, columns);
+    
+    // the fast path needs every lane drawing the same sprite to the same place, in the same resolution
+    bool uniform = true;
+    each_lane(group, [&](const int lane) {
+        LaneBlock& block = blocks[lane / lane_width];
+        
+        uniform &= byte_of(block.v[instruction.x], lane) == x_pos && byte_of(block.v[instruction.y], lane) == y_pos && index[lane] == address;
+        uniform &= (byte_of(block.hires, lane) != 0) == hires;
+    });
+    
+    for(int byte = 0; byte < rows * columns / 8; byte++)
+        uniform &= !divergent[(address + byte) & 0xfff];
+    
+    if(uniform) {
+        const int width = hires ? hires_screen_width : screen_width;
+        const int height = hires ? hires_screen_height : screen_height;
+        
+        // so every pixel it touches is one vector op over the lanes
+        each_block(group, [&](LaneBlock& block) {
+            const lane_vector one = block.mask & splat(1);
+            lane_vector collision = {};
+            
+            for(int row = 0; row < rows; row++) {
+                const uint16_t sprite = sprite_row(first, address, columns, row);
+                
+                for(int column = 0; column < columns; column++) {
+                    if((sprite & (0x8000 >> column)) == 0)
+                        continue;
+                    
+                    lane_vector& pixel = block.pixels[pixel_coord((x_pos + column) % width, (y_pos + row) % height)];
+                    collision |= pixel & one;
+                    pixel ^= one;
+                }
+            }
+            
+            block.v[0xF] = blend(block.mask, collision, block.v[0xF]);
+            
+            // anti-flicker skips presenting draws that erased something
+            const lane_vector dirty = options.enable_anti_flicker ? collision ^ splat(1) : splat(1);
+            block.draw_dirty = blend(block.mask, dirty, block.draw_dirty);
+        });
+        
+        return;
+    }
+    
+    each_lane(group, [&](const int lane) {
+        LaneBlock& block = blocks[lane / lane_width];
+        const uint8_t lane_x = byte_of(block.v[instruction.x], lane);
+        const uint8_t lane_y = byte_of(block.v[instruction.y], lane);
+        const bool lane_hires = byte_of(block.hires, lane) != 0;
+        
+        const int width = lane_hires ? hires_screen_width : screen_width;
+        const int height = lane_hires ? hires_screen_height : screen_height;
+        
+        int lane_rows, lane_columns;
+        sprite_size(lane_hires, lane_rows, lane_columns);
+        
+        uint8_t collision = 0, dirty = 1;
+        for(int row = 0; row < lane_rows; row++) {
+            const uint16_t sprite = sprite_row(lane, index[lane], lane_columns, row);
+            
+            for(int column = 0; column < lane_columns; column++) {
+                if((sprite & (0x8000 >> column)) == 0)
+                    continue;
+                
+                uint8_t& pixel = byte_of(block.pixels[pixel_coord((lane_x + column) % width, (lane_y + row) % height)], lane);
+                if(pixel == 1) {
+                    collision = 1;
+                    
+                    if(options.enable_anti_flicker)
+                        dirty = 0;
+                }
+                
+                pixel ^= 1;
+            }
+        }
+        
+        byte_of(block.v[0xF], lane) = collision;
+        byte_of(block.draw_dirty, lane) = dirty;
+    });
+}
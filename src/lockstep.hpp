@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "emu.hpp"
+
+// only available when chip8-shared is built with CHIP8_LOCKSTEP (gcc and clang, for their vector extensions)
+// runs many copies of one rom in lockstep. registers, timers, keys and the framebuffer are stored as structure of
+// arrays, so while every lane is at the same instruction it runs as SIMD operations over all of them (AVX2 or SSE,
+// depending on what chip8-shared is compiled for). once lanes diverge they're grouped by opcode, and each group
+// runs the same code with a mask until they line back up. results match Machine exactly.
+
+struct LaneBlock;
+
+// which instruction set the lanes are vectorised with (avx2, sse or scalar)
+extern const char* const lockstep_isa;
+
+class Lockstep {
+public:
+    explicit Lockstep(const int lane_count);
+    ~Lockstep();
+    
+    Lockstep(const Lockstep&) = delete;
+    Lockstep& operator=(const Lockstep&) = delete;
+    
+    // loads the same rom into every lane, see Machine::load_rom
+    bool load_rom(const char* path);
+    
+    int lane_count() const {
+        return lanes;
+    }
+    
+    // copies a single lane in or out, for setting up different starting states and reading results
+    EmulatorState get_lane(const int lane) const;
+    void set_lane(const int lane, const EmulatorState& state);
+    
+    void set_key(const int lane, const int key, const bool pressed);
+    
+    // decrements every lane's timers, see Machine::tick_timers
+    void tick_timers();
+    
+    // executes count instructions on every lane
+    void run(const uint64_t count);
+    
+    EmuOptions options;
+    
+    // seeds CXNN in every lane, see Machine::seed
+    uint32_t seed = 1;
+    
+    // how many steps ran with every lane together, and how many needed more than one group
+    uint64_t converged_steps = 0, divergent_steps = 0;
+    
+    // summed over every lane, see Machine::unimplemented_opcodes
+    uint64_t unimplemented_opcodes = 0;
+
+private:
+    // lanes that run one instruction together, mask bytes in their blocks are set for them
+    struct Group {
+        uint16_t opcode = 0;
+        std::vector<int> lanes;
+        int first_block = 0, last_block = 0;
+        
+        // every lane, so lane loops don't have to go through lanes
+        bool all = false;
+    };
+    
+    template<typename F>
+    void each_lane(const Group& group, F f);
+    
+    template<typename F>
+    void each_block(const Group& group, F f);
+    
+    void step();
+    void execute(const Instruction& instruction, const Group& group);
+    void draw(const Instruction& instruction, const Group& group);
+    
+    uint16_t fetch_opcode(const int lane) const;
+    bool check_converged() const;
+    
+    void write_lane(const int lane, const EmulatorState& state);
+    void update_divergent(const uint16_t address, const int length);
+    void refresh_divergent();
+    
+    uint8_t& lane_register(const int lane, const int index);
+    
+    int lanes = 0;
+    
+    // SIMD data, one LaneBlock per lane_width lanes
+    std::vector<LaneBlock> blocks;
+    
+    // per lane data that's addressed by lane anyway
+    std::vector<uint16_t> pc, index;
+    std::vector<std::array<uint8_t, 4096>> memory;
+    std::vector<std::array<uint16_t, stack_size>> stack;
+    std::vector<int> stack_pointer;
+    std::vector<uint32_t> random_state;
+    
+    // memory bytes that aren't the same in every lane, anything else can be read from lane 0
+    std::array<bool, 4096> divergent = {};
+    
+    // whether every lane is at the same PC, with the same code there
+    bool converged = false;
+    
+    Group full_group;
+    bool masks_full = true;
+    
+    // groups for steps where the lanes have split up, found through the opcode they're at
+    std::vector<Group> groups;
+    std::vector<int> group_of_opcode;
+};
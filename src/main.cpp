@@ -1,13 +1,18 @@
 #include <iostream>
 #include <iomanip>
 #include <cstdio>
+#include <cstring>
 #include <climits>
 #include <cmath>
 #include <SDL.h>
-#include <map>
-#include <filesystem>
 #include <vector>
 #include <array>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include "emu.hpp"
 #include "glad/glad.h"
@@ -16,97 +21,299 @@
 #include "imgui_impl_opengl3.h"
 #include "imgui_stdlib.h"
 #include "compiler.hpp"
+#include "headless.hpp"
+#include "scheduler.hpp"
+#include "pixel_ring.hpp"
+#include "triple_buffer.hpp"
+#include "disassembler.hpp"
+#include "beeper.hpp"
+#include "rom_catalog.hpp"
+#include "rom_pack.hpp"
 
-constexpr std::array<uint8_t, 80> chip8_fontset = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
+// the chip-8 key for every scancode, -1 where there isn't one
+const std::array<int8_t, SDL_NUM_SCANCODES> scancodes = [] {
+    std::array<int8_t, SDL_NUM_SCANCODES> keys;
+    keys.fill(-1);
+    
+    keys[SDL_SCANCODE_0] = 0;
+    keys[SDL_SCANCODE_1] = 1;
+    keys[SDL_SCANCODE_2] = 2;
+    keys[SDL_SCANCODE_3] = 3;
+    keys[SDL_SCANCODE_4] = 4;
+    keys[SDL_SCANCODE_5] = 5;
+    keys[SDL_SCANCODE_6] = 6;
+    
+    keys[SDL_SCANCODE_KP_0] = 0;
+    keys[SDL_SCANCODE_KP_1] = 1;
+    keys[SDL_SCANCODE_KP_2] = 2;
+    keys[SDL_SCANCODE_KP_3] = 3;
+    keys[SDL_SCANCODE_KP_4] = 4;
+    keys[SDL_SCANCODE_KP_5] = 5;
+    keys[SDL_SCANCODE_KP_6] = 6;
+    
+    return keys;
+}();
 
-const std::map<SDL_Scancode, int> scancodes = {
-    {SDL_SCANCODE_0, 0},
-    {SDL_SCANCODE_1, 1},
-    {SDL_SCANCODE_2, 2},
-    {SDL_SCANCODE_3, 3},
-    {SDL_SCANCODE_4, 4},
-    {SDL_SCANCODE_5, 5},
-    {SDL_SCANCODE_6, 6},
-    
-    {SDL_SCANCODE_KP_0, 0},
-    {SDL_SCANCODE_KP_1, 1},
-    {SDL_SCANCODE_KP_2, 2},
-    {SDL_SCANCODE_KP_3, 3},
-    {SDL_SCANCODE_KP_4, 4},
-    {SDL_SCANCODE_KP_5, 5},
-    {SDL_SCANCODE_KP_6, 6}
+// everything the emulation thread publishes for the gui after running
+struct Frame {
+    // counts up by one per publish, so the gui can tell when it skipped some
+    uint64_t number = 0;
+    
+    // whether the machine was running, rather than paused or without a rom
+    bool running = false;
+    
+    EmulatorState state;
+    
+    // the grid instances, while grid view is on
+    std::vector<EmulatorState> grid;
 };
 
+TripleBuffer<Frame> frames;
+
+// work for the emulation thread, queued up by the gui
+std::mutex command_mutex;
+std::vector<std::function<void()>> commands;
+
+void send_command(std::function<void()> command) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    commands.push_back(std::move(command));
+}
+
+// key presses, timestamped as they're polled so the scheduler can put them at the right instruction
+InputQueue input;
+
+// written by the emulation thread, rendered by the audio callback
+Beeper beeper(44100);
+
+// opened by the gui, 0 while there's no device, the emulation thread doesn't feed the beeper then
+std::atomic<SDL_AudioDeviceID> audio_device = 0;
+
+std::atomic<bool> quit_emulation = false;
+
+// only touched by the emulation thread
+Machine machine;
+Scheduler scheduler;
+
 bool is_rom_open = false;
+bool pause_execution = false;
 
-void load_rom(const char* path) {
-    state.reset();
+// grid view runs copies of the machine side by side, each one with its own tile in the screen atlas
+struct GridInstance {
+    Machine machine;
+    Scheduler scheduler;
+};
+
+std::vector<GridInstance> grid;
+
+// forks every grid instance off the machine as it is now, seeded differently so games play out differently
+void start_grid(const int size) {
+    grid.clear();
+    grid.resize(size);
     
-    memcpy(state.memory, chip8_fontset.data(), chip8_fontset.size());
+    for(int i = 0; i < size; i++) {
+        GridInstance& instance = grid[i];
+        instance.machine.options = machine.options;
+        instance.machine.seed = std::max<uint32_t>(machine.seed + i, 1);
+        instance.machine.state = machine.state;
+        instance.machine.state.random_state = instance.machine.seed;
+        instance.machine.state.mark_rows_dirty(0, hires_screen_height);
+        instance.machine.state.draw_dirty = true;
+        instance.machine.flush_decode_cache();
+        
+        instance.scheduler.instructions_per_second = scheduler.instructions_per_second;
+        instance.scheduler.restart(Scheduler::clock::now());
+    }
+}
 
-    FILE* file = fopen(path, "rb");
+// the grid keeps time with the machine, so whenever its scheduler restarts theirs do too
+void restart_schedulers(const Scheduler::clock::time_point now) {
+    scheduler.restart(now);
     
-    fseek(file, 0L, SEEK_END);
-    auto sz = ftell(file);
-    fseek(file, 0L, SEEK_SET);
+    for(auto& instance : grid)
+        instance.scheduler.restart(now);
+}
+
+// restarts timing and the grid around whatever load_rom just loaded
+void started_rom(const bool loaded) {
+    is_rom_open = loaded;
     
-    fread(state.memory + program_begin, sz, 1, file);
+    if(!grid.empty())
+        start_grid(grid.size());
     
-    is_rom_open = true;
+    restart_schedulers(Scheduler::clock::now());
 }
 
-std::string get_short_debug_string(uint16_t opcode) {
-    if(opcode == 0)
-        return "invalid opcode";
-    
-    const uint16_t id = opcode >> 12;
-    const uint8_t nn = opcode & 0x00ff;
-    
-    switch(id) {
-        case 0x0:
-        {
-            if(nn == 0xE0) {
-                return "clear screen";
-            }
-        }
-            break;
-        case 0x2:
-        {
-            return "call subroutine";
+// a frame that's ready to draw takes the dirty rows with it, while anti-flicker holds one back they keep growing
+void take_dirty_rows(EmulatorState& state, EmulatorState& published) {
+    published = state;
+    
+    if(state.draw_dirty) {
+        state.dirty_begin = state.dirty_end = 0;
+        state.draw_dirty = false;
+    }
+}
+
+void publish_frame() {
+    static uint64_t published = 0;
+    
+    Frame& frame = frames.write_buffer();
+    frame.number = ++published;
+    frame.running = is_rom_open && !pause_execution;
+    
+    take_dirty_rows(machine.state, frame.state);
+    
+    frame.grid.resize(grid.size());
+    for(size_t i = 0; i < grid.size(); i++)
+        take_dirty_rows(grid[i].machine.state, frame.grid[i]);
+    
+    frames.publish();
+}
+
+// runs the machines in real time, independent of how fast the gui is presenting
+void run_emulation() {
+    std::vector<std::function<void()>> pending;
+    
+    while(!quit_emulation) {
+        // commands wait for the next loop rather than the gui
+        if(command_mutex.try_lock()) {
+            pending.swap(commands);
+            command_mutex.unlock();
         }
-            break;
-        case 0x6:
-        {
-            return "v[x] = nn";
+        
+        bool changed = !pending.empty();
+        for(auto& command : pending)
+            command();
+        
+        pending.clear();
+        
+        const auto now = Scheduler::clock::now();
+        const bool running = is_rom_open && !pause_execution;
+        
+        if(running) {
+            changed |= scheduler.advance(machine, now, &input, audio_device != 0 ? &beeper : nullptr) > 0;
+            
+            // the grid plays along with the keys pressed for the machine
+            for(auto& instance : grid) {
+                std::copy(std::begin(machine.state.keys), std::end(machine.state.keys), instance.machine.state.keys);
+                instance.scheduler.advance(instance.machine, now);
+            }
+        } else {
+            apply_input(machine, input, now);
         }
-            break;
-        case 0xD:
-            return "display sprite";
+        
+        if(changed)
+            publish_frame();
+        
+        std::this_thread::sleep_until(running ? scheduler.next_tick() : now + std::chrono::milliseconds(5));
     }
-    
-    return "";
 }
 
 GLuint quad_vao = 0;
 GLuint pixel_program = 0;
 GLuint pixels_texture = 0;
+GLint grid_location = -1;
+GLint palette_location = -1;
+
+// the resolution of each instance, as two shorts per instance
+GLuint instance_vbo = 0;
+
+// off and on pixel colours
+float palette[2][3] = {
+    {0.0f, 0.0f, 0.0f},
+    {1.0f, 1.0f, 1.0f}
+};
+
+PixelRing pixel_ring;
+
+void render_audio(void* userdata, Uint8* stream, int length) {
+    static_cast<Beeper*>(userdata)->render(reinterpret_cast<int16_t*>(stream), length / sizeof(int16_t));
+}
+
+// (re)opens the audio device with a buffer of about buffer_ms, there's just no sound if that fails
+void open_audio(const int buffer_ms) {
+    if(audio_device != 0) {
+        SDL_CloseAudioDevice(audio_device);
+        audio_device = 0;
+    }
+    
+    // SDL wants a power of two
+    int samples = 64;
+    while(samples < beeper.sample_rate * buffer_ms / 1000)
+        samples *= 2;
+    
+    SDL_AudioSpec desired = {};
+    desired.freq = beeper.sample_rate;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = samples;
+    desired.callback = render_audio;
+    desired.userdata = &beeper;
+    
+    // the emulation thread hands audio over a tick at a time, so a tick on top of the buffer has to be queued up
+    // to keep the device fed in between. the callback isn't running while the device is closed
+    beeper.start_queued = beeper.sample_rate / Scheduler::ticks_per_second + samples;
+    beeper.max_queued = beeper.start_queued * 2;
+    
+    audio_device = SDL_OpenAudioDevice(nullptr, 0, &desired, nullptr, 0);
+    if(audio_device == 0) {
+        fprintf(stderr, "couldn't open audio: %s\n", SDL_GetError());
+        return;
+    }
+    
+    SDL_PauseAudioDevice(audio_device, 0);
+}
+
+// the gui's side of the last frame it took. screens are the instances on screen in tile order, their dirty rows
+// are the ones waiting to be uploaded
+uint64_t shown_frame = 0;
+bool shown_running = false;
+EmulatorState shown_state;
+std::vector<EmulatorState> screens(1);
+
+// for the debugger, kept up to date with shown_state's memory
+Disassembly disassembly;
+
+// takes the newest frame, if there is one. the rows a frame marked dirty add up with the ones that haven't been
+// uploaded yet, unless frames were skipped or the screens changed, then everything goes up again
+void take_frame() {
+    if(!frames.update())
+        return;
+    
+    const Frame& frame = frames.read_buffer();
+    
+    for(int address = 0; address < 4096; address++) {
+        if(frame.state.memory[address] != shown_state.memory[address])
+            disassembly.invalidate(address, 1);
+    }
+    
+    shown_state = frame.state;
+    shown_running = frame.running;
+    
+    const bool grid_shown = !frame.grid.empty();
+    const size_t count = grid_shown ? frame.grid.size() : 1;
+    
+    bool redraw = frame.number != shown_frame + 1 || count != screens.size();
+    shown_frame = frame.number;
+    
+    screens.resize(count);
+    for(size_t i = 0; i < count; i++) {
+        const EmulatorState& state = grid_shown ? frame.grid[i] : frame.state;
+        EmulatorState& screen = screens[i];
+        
+        const bool pending = screen.draw_dirty;
+        const int begin = screen.dirty_begin, end = screen.dirty_end;
+        
+        screen = state;
+        
+        if(redraw) {
+            screen.mark_rows_dirty(0, hires_screen_height);
+            screen.draw_dirty = true;
+        } else if(pending) {
+            screen.mark_rows_dirty(begin, end);
+            screen.draw_dirty = true;
+        }
+    }
+}
 
 void setup_gfx() {
     // create quad for pixel rendering
@@ -136,6 +343,16 @@ void setup_gfx() {
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, atlas_max_tiles * 2 * sizeof(uint16_t), nullptr, GL_STREAM_DRAW);
+    
+    // unsigned shorts, read as the uvec2 in_resolution
+    glVertexAttribIPointer(2, 2, GL_UNSIGNED_SHORT, 0, nullptr);
+    glVertexAttribDivisor(2, 1);
+    
+    glEnableVertexAttribArray(2);
+    
     GLuint ebo = 0;
     glGenBuffers(1, &ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
@@ -145,22 +362,40 @@ void setup_gfx() {
         "#version 330 core\n"
         "layout (location = 0) in vec3 in_position;\n"
         "layout (location = 1) in vec2 in_uv;\n"
+        "layout (location = 2) in uvec2 in_resolution;\n"
         "out vec2 uv;\n"
+        "flat out ivec2 resolution;\n"
+        "flat out ivec2 tile;\n"
+        "uniform ivec2 grid;\n"
+        "uniform int atlas_columns;\n"
         "void main()\n"
         "{\n"
-        "   gl_Position = vec4(in_position.xyz, 1.0);\n"
+        "   // every instance gets a cell of the quad, in the same order as its tile in the atlas\n"
+        "   ivec2 cell = ivec2(gl_InstanceID % grid.x, gl_InstanceID / grid.x);\n"
+        "   vec2 cell_size = vec2(1.0) / vec2(grid);\n"
+        "   gl_Position.x = -0.5 + (float(cell.x) + in_position.x + 0.5) * cell_size.x;\n"
+        "   gl_Position.y = 0.5 - (float(cell.y) + 0.5 - in_position.y) * cell_size.y;\n"
+        "   gl_Position.zw = vec2(in_position.z, 1.0);\n"
         "   uv = in_uv;\n"
+        "   resolution = ivec2(in_resolution);\n"
+        "   tile = ivec2(gl_InstanceID % atlas_columns, gl_InstanceID / atlas_columns);\n"
         "}\n";
     const char* vertex_src = vertex_glsl.data();
     
     constexpr std::string_view fragment_glsl =
         "#version 330 core\n"
         "in vec2 uv;\n"
+        "flat in ivec2 resolution;\n"
+        "flat in ivec2 tile;\n"
         "out vec4 out_color;\n"
-        "uniform sampler2D pixel_texture;\n"
+        "uniform usampler2D pixel_texture;\n"
+        "uniform vec3 palette[2];\n"
         "void main()\n"
         "{\n"
-        "    out_color.rgb = vec3(1) * (texture(pixel_texture, uv).r * 255);\n"
+        "    ivec2 pixel = min(ivec2(uv * vec2(resolution)), resolution - 1);\n"
+        "    ivec2 tile_origin = tile * ivec2(4, 64);\n"
+        "    uint texel = texelFetch(pixel_texture, tile_origin + ivec2(pixel.x / 32, pixel.y), 0).r;\n"
+        "    out_color.rgb = palette[(texel >> uint(31 - pixel.x % 32)) & 1u];\n"
         "}\n";
     const char* fragment_src = fragment_glsl.data();
     
@@ -181,24 +416,53 @@ void setup_gfx() {
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
     
+    grid_location = glGetUniformLocation(pixel_program, "grid");
+    palette_location = glGetUniformLocation(pixel_program, "palette");
+    
+    glUseProgram(pixel_program);
+    glUniform1i(glGetUniformLocation(pixel_program, "atlas_columns"), atlas_columns);
+    glUseProgram(0);
+    
+    // 1 bit per pixel, 32 to a texel, allocated once with a hires sized tile per instance.
+    // low resolution only uses the top left corner of a tile
+    const std::vector<uint32_t> blank(atlas_width * atlas_height);
+    
     glGenTextures(1, &pixels_texture);
     glBindTexture(GL_TEXTURE_2D, pixels_texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, screen_width, screen_height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, atlas_width, atlas_height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, blank.data());
     glBindTexture(GL_TEXTURE_2D, 0);
+    
+    pixel_ring.create();
 }
 
 int main(int argc, char* argv[]) {
+    if(argc > 1 && !strcmp(argv[1], "--headless"))
+        return run_headless(argc - 2, argv + 2);
+    
+    if(argc > 1 && !strcmp(argv[1], "--disassemble"))
+        return run_disassemble(argc - 2, argv + 2);
+    
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
     
+    // separately, so a machine without audio still runs. SDL_AUDIODRIVER=dummy works too
+    int audio_buffer_ms = 10;
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) == 0)
+        open_audio(audio_buffer_ms);
+    else
+        fprintf(stderr, "couldn't initialise audio: %s\n", SDL_GetError());
+    
+    // games should still play out differently every time
+    machine.seed = std::max<uint32_t>(time(nullptr), 1);
+    
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     
     SDL_Window* window = SDL_CreateWindow("chip8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 480, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
-        
+    
     SDL_GLContext gl_context = SDL_GL_CreateContext(window);
     SDL_GL_MakeCurrent(window, gl_context);
     SDL_GL_SetSwapInterval(1);
@@ -208,31 +472,48 @@ int main(int argc, char* argv[]) {
     
     ImGui::CreateContext();
     ImGui::StyleColorsDark();
-
+    
     ImGui_ImplSDL2_InitForOpenGL(window, gl_context);
     ImGui_ImplOpenGL3_Init("#version 330 core");
     
-    std::vector<std::string> rom_paths;
-    for(auto& p: std::filesystem::directory_iterator("roms/"))
-        rom_paths.push_back(p.path());
+    // the menu keeps its own copy of the roms, taken whenever the scan finds something new
+    RomCatalog catalog;
+    catalog.open("roms");
+    
+    std::vector<RomInfo> roms;
+    std::vector<std::string> packs;
+    uint64_t roms_version = 0;
+    std::string open_rom_path;
+    
+    // the pack that was last looked at in the menu, mapped until another one is
+    RomPack pack;
+    std::string pack_path;
+    
+    // the gui's copies of what it can change, the emulation thread gets them through commands
+    EmuOptions options = machine.options;
+    int instructions_per_second = scheduler.instructions_per_second;
+    bool paused = false;
+    bool show_grid = false;
+    int grid_size = 64;
+    
+    // runs until the window closes, publishing frames for the loop below to draw whenever it gets to them
+    std::thread emulation(run_emulation);
     
     bool running = true;
     while(running) {
         SDL_Event event = {};
         while(SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
-
+            
             if(event.type == SDL_QUIT)
                 running = false;
             
-            if(event.type == SDL_KEYDOWN) {
-                if(scancodes.count(event.key.keysym.scancode))
-                    state.keys[scancodes.at(event.key.keysym.scancode)] = 1;
-            }
-            
-            if(event.type == SDL_KEYUP) {
-                if(scancodes.count(event.key.keysym.scancode))
-                    state.keys[scancodes.at(event.key.keysym.scancode)] = 0;
+            if(event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+                const int key = scancodes[event.key.keysym.scancode];
+                
+                // nobody can type 256 keys between two emulation loops, but a full queue drops rather than waits
+                if(key >= 0)
+                    input.push({Scheduler::clock::now(), uint8_t(key), event.type == SDL_KEYDOWN});
             }
         }
         
@@ -243,9 +524,77 @@ int main(int argc, char* argv[]) {
         if(ImGui::BeginMainMenuBar()) {
             if(ImGui::BeginMenu("File")) {
                 if(ImGui::BeginMenu("Open ROM...")) {
-                    for(auto& rom : rom_paths) {
-                        if(ImGui::Button(rom.c_str()))
-                            load_rom(rom.c_str());
+                    if(catalog.version() != roms_version) {
+                        roms_version = catalog.version();
+                        roms = catalog.entries();
+                        packs = catalog.packs();
+                    }
+                    
+                    if(catalog.scanning())
+                        ImGui::TextDisabled("Scanning roms/...");
+                    
+                    ImGui::BeginChild("roms", ImVec2(400, 300));
+                    
+                    // there can be tens of thousands, only the ones in view are drawn
+                    ImGuiListClipper clipper;
+                    clipper.Begin(roms.size());
+                    while(clipper.Step()) {
+                        for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                            const RomInfo& rom = roms[i];
+                            
+                            char label[512];
+                            snprintf(label, sizeof(label), "%s (%s)", rom.path.c_str(), platform_name(rom.platform));
+                            
+                            if(ImGui::Selectable(label, rom.path == open_rom_path)) {
+                                open_rom_path = rom.path;
+                                apply_quirks(rom, options);
+                                
+                                send_command([path = rom.path, options = options] {
+                                    machine.options = options;
+                                    started_rom(machine.load_rom(path.c_str()));
+                                });
+                            }
+                        }
+                    }
+                    
+                    ImGui::EndChild();
+                    ImGui::EndMenu();
+                }
+                
+                if(ImGui::BeginMenu("Open ROM Pack...", !packs.empty())) {
+                    for(auto& path : packs) {
+                        if(!ImGui::BeginMenu(path.c_str()))
+                            continue;
+                        
+                        if(path != pack_path) {
+                            pack_path = path;
+                            
+                            if(!pack.open(path.c_str()))
+                                fprintf(stderr, "couldn't open pack %s\n", path.c_str());
+                        }
+                        
+                        ImGui::BeginChild("pack", ImVec2(400, 300));
+                        
+                        ImGuiListClipper clipper;
+                        clipper.Begin(pack.size());
+                        while(clipper.Step()) {
+                            for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                                const PackEntry entry = pack.entry(i);
+                                const std::string name(entry.name);
+                                
+                                if(ImGui::Selectable(name.c_str())) {
+                                    open_rom_path.clear();
+                                    
+                                    // copied, the pack can be closed before the emulation thread gets to it
+                                    send_command([rom = std::vector<uint8_t>(entry.data, entry.data + entry.size)] {
+                                        started_rom(machine.load_rom(rom.data(), rom.size()));
+                                    });
+                                }
+                            }
+                        }
+                        
+                        ImGui::EndChild();
+                        ImGui::EndMenu();
                     }
                     
                     ImGui::EndMenu();
@@ -255,59 +604,134 @@ int main(int argc, char* argv[]) {
             }
             
             if(ImGui::BeginMenu("Options")) {
-                ImGui::MenuItem("Enable Anti-flicker", nullptr, &options.enable_anti_flicker);
-                ImGui::MenuItem("Emulate Original CHIP-8", nullptr, &options.emulate_original);
-
+                bool changed = ImGui::MenuItem("Enable Anti-flicker", nullptr, &options.enable_anti_flicker);
+                changed |= ImGui::MenuItem("Emulate Original CHIP-8", nullptr, &options.emulate_original);
+                
+                if(changed) {
+                    send_command([options = options] {
+                        machine.options = options;
+                    });
+                    
+                    // and next time the rom is opened
+                    if(!open_rom_path.empty())
+                        catalog.set_quirks(open_rom_path, options);
+                }
+                
+                if(ImGui::SliderInt("Instructions per second", &instructions_per_second, 60, 5000)) {
+                    send_command([instructions_per_second = instructions_per_second] {
+                        scheduler.instructions_per_second = instructions_per_second;
+                    });
+                }
+                
+                // reopening the device cuts the sound out for a moment, so only once the slider is let go
+                ImGui::SliderInt("Audio buffer (ms)", &audio_buffer_ms, 5, 100);
+                if(ImGui::IsItemDeactivatedAfterEdit() && audio_device != 0)
+                    open_audio(audio_buffer_ms);
+                
+                ImGui::ColorEdit3("Background", palette[0]);
+                ImGui::ColorEdit3("Foreground", palette[1]);
+                
+                ImGui::EndMenu();
+            }
+            
+            if(ImGui::BeginMenu("View")) {
+                bool changed = ImGui::MenuItem("Grid", nullptr, &show_grid);
+                changed |= ImGui::SliderInt("Grid instances", &grid_size, 1, atlas_max_tiles) && show_grid;
+                
+                // the gui notices the screens changing and uploads all of them again
+                if(changed) {
+                    send_command([size = show_grid ? grid_size : 0] {
+                        if(size > 0)
+                            start_grid(size);
+                        else
+                            grid.clear();
+                    });
+                }
+                
                 ImGui::EndMenu();
             }
             
             ImGui::EndMainMenuBar();
         }
         
-        if(state.delay_timer > 0)
-            state.delay_timer--;
+        take_frame();
         
-        const uint16_t opcode = (state.memory[state.PC] << 8) | state.memory[state.PC + 1];
-        if(is_rom_open && !pause_execution)
-            process_opcode(opcode);
-            
         if(ImGui::Begin("Memory")) {
             for(int i = 0; i < 16; i++)
-                ImGui::Text("V[%i] = %i", i, state.v[i]);
+                ImGui::Text("V[%i] = %i", i, shown_state.v[i]);
             
-            for(int i = program_begin; i < 4096; i++)
-                ImGui::Text("mem[%i] = %i", i, state.memory[i]);
-        }
+            ImGui::BeginChild("memory_view", ImVec2(-1, -1), true);
+            
+            // 16 bytes per row, only the rows in view get formatted
+            constexpr int bytes_per_row = 16;
+            
+            ImGuiListClipper clipper;
+            clipper.Begin(4096 / bytes_per_row);
+            while(clipper.Step()) {
+                for(int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                    const int address = row * bytes_per_row;
+                    
+                    char line[8 + bytes_per_row * 3];
+                    int length = snprintf(line, sizeof(line), "%03X:", address);
+                    
+                    for(int i = 0; i < bytes_per_row; i++)
+                        length += snprintf(line + length, sizeof(line) - length, " %02X", shown_state.memory[address + i]);
+                    
+                    ImGui::TextUnformatted(line, line + length);
+                }
+            }
             
+            ImGui::EndChild();
+        }
+        
         ImGui::End();
         
         if(ImGui::Begin("Debugger")) {
-            if(ImGui::Button(pause_execution ? "Play" : "Pause"))
-                pause_execution = !pause_execution;
+            if(ImGui::Button(paused ? "Play" : "Pause")) {
+                paused = !paused;
+                
+                send_command([paused = paused] {
+                    pause_execution = paused;
+                    
+                    // don't try to catch up on the time spent paused
+                    restart_schedulers(Scheduler::clock::now());
+                });
+            }
             
             ImGui::SameLine();
             
-            if(ImGui::Button("Step"))
-                process_opcode(opcode);
+            if(ImGui::Button("Step")) {
+                send_command([] {
+                    machine.step();
+                });
+            }
             
             static bool enable_auto_scroll = true;
             ImGui::Checkbox("Enable auto scroll", &enable_auto_scroll);
             
             ImGui::BeginChild("progam_edit", ImVec2(-1, -1), true);
             
-            for(int i = program_begin; i < 4096; i += 2) {
-                std::string s;
-                s.reserve(50);
-                
-                uint16_t opcode = (state.memory[i] << 8) | state.memory[i + 1];
-                auto debug_string = get_short_debug_string(opcode);
-
-                sprintf(s.data(), "[0x%02X] 0x%04X ; %s", i, opcode, debug_string.c_str());
-                
-                ImGui::Selectable(s.c_str(), state.PC == i);
-                
-                if(state.PC == i && enable_auto_scroll && !pause_execution && is_rom_open) {
-                    ImGui::SetScrollHereY();
+            // one row per instruction from program_begin, only the rows in view get formatted
+            const int rows = (4096 - program_begin) / 2;
+            const float row_height = ImGui::GetTextLineHeightWithSpacing();
+            
+            // rows that aren't drawn can't scroll themselves into view, so PC is centred from its row instead
+            if(enable_auto_scroll && shown_running && shown_state.PC >= program_begin) {
+                const int pc_row = (shown_state.PC - program_begin) / 2;
+                ImGui::SetScrollY(pc_row * row_height - (ImGui::GetWindowHeight() - row_height) / 2);
+            }
+            
+            ImGuiListClipper clipper;
+            clipper.Begin(rows, row_height);
+            while(clipper.Step()) {
+                for(int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                    const int address = program_begin + row * 2;
+                    const uint16_t opcode = (shown_state.memory[address] << 8) | shown_state.memory[address + 1];
+                    
+                    char line[64];
+                    snprintf(line, sizeof(line), "[0x%02X] 0x%04X ; %s", address, opcode, disassembly.at(shown_state.memory, address));
+                    
+                    ImGui::Selectable(line, shown_state.PC == address);
                 }
             }
             
@@ -322,49 +746,86 @@ int main(int argc, char* argv[]) {
                 "count += 3;\n"
                 "draw_char(0, 5, count);\n"
                 "jump(main);";
-
+            
+            static CompiledProgram compiled;
+            
             ImGui::InputTextMultiline("Code", &test_program);
             
-            if(ImGui::MenuItem("Compile")) {
-                state.reset();
-                
-                memcpy(state.memory, chip8_fontset.data(), chip8_fontset.size());
-                
-                compile(test_program);
-            }
+            if(ImGui::MenuItem("Compile"))
+                compiled = compile(test_program);
             
-            if(ImGui::MenuItem("Run")) {
-                load_compiled_rom();
+            if(ImGui::MenuItem("Run") && compiled.error.empty() && !compiled.rom.empty()) {
+                open_rom_path.clear();
                 
-                is_rom_open = true;
+                send_command([rom = compiled.rom] {
+                    started_rom(machine.load_rom(rom.data(), rom.size()));
+                });
             }
+            
+            if(!compiled.error.empty() && compiled.error_line > 0)
+                ImGui::Text("line %i: %s", compiled.error_line, compiled.error.c_str());
+            else if(!compiled.error.empty())
+                ImGui::Text("%s", compiled.error.c_str());
+            else if(!compiled.rom.empty())
+                ImGui::Text("%i bytes", int(compiled.rom.size()));
         }
         
         ImGui::End();
         
-        if(state.draw_dirty) {
-            glBindTexture(GL_TEXTURE_2D, pixels_texture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, screen_width, screen_height, 0, GL_RED, GL_UNSIGNED_BYTE, state.pixels);
-            glBindTexture(GL_TEXTURE_2D, 0);
+        // only the rows that changed since the last upload, of the tiles that need presenting
+        std::vector<TileUpload> uploads;
+        for(size_t tile = 0; tile < screens.size(); tile++) {
+            const EmulatorState& state = screens[tile];
+            const int end = std::min(state.dirty_end, state.height());
             
-            state.draw_dirty = false;
+            if(state.draw_dirty && state.dirty_begin < end)
+                uploads.push_back({&state, int(tile), state.dirty_begin, end});
         }
-                
+        
+        // when the slot is still busy the rows stay dirty and go up next frame
+        if(pixel_ring.upload(pixels_texture, uploads.data(), uploads.size())) {
+            for(auto& state : screens) {
+                if(state.draw_dirty) {
+                    state.dirty_begin = state.dirty_end = 0;
+                    state.draw_dirty = false;
+                }
+            }
+        }
+        
+        std::vector<uint16_t> resolutions;
+        for(auto& state : screens) {
+            resolutions.push_back(state.width());
+            resolutions.push_back(state.height());
+        }
+        
+        const int grid_columns = std::ceil(std::sqrt(double(screens.size())));
+        const int grid_rows = (screens.size() + grid_columns - 1) / grid_columns;
+        
         ImGui::Render();
         
         auto& io = ImGui::GetIO();
         glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
         glClear(GL_COLOR_BUFFER_BIT);
         
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, resolutions.size() * sizeof(uint16_t), resolutions.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        
+        // every instance in one draw
         glUseProgram(pixel_program);
+        glUniform2i(grid_location, grid_columns, grid_rows);
+        glUniform3fv(palette_location, 2, palette[0]);
         glBindVertexArray(quad_vao);
         glBindTexture(GL_TEXTURE_2D, pixels_texture);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, screens.size());
+        
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         
         SDL_GL_SwapWindow(window);
     }
-
+    
+    quit_emulation = true;
+    emulation.join();
+    
     return 0;
 }
@@ -0,0 +1,116 @@
+#include "pixel_ring.hpp"
+
+#include <SDL.h>
+
+// ARB_buffer_storage is core in 4.4, newer than what glad was generated for
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP buffer_storage_func)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+constexpr GLsizeiptr tile_size = framebuffer_row_texels * hires_screen_height * sizeof(uint32_t);
+
+// enough for every tile at once
+constexpr GLsizeiptr slot_size = tile_size * atlas_max_tiles;
+
+void PixelRing::create() {
+    buffer_storage_func buffer_storage = nullptr;
+    if(SDL_GL_ExtensionSupported("GL_ARB_buffer_storage"))
+        buffer_storage = reinterpret_cast<buffer_storage_func>(SDL_GL_GetProcAddress("glBufferStorage"));
+    
+    persistent = buffer_storage != nullptr;
+    
+    const GLbitfield persistent_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    
+    for(auto& slot : slots) {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        
+        if(persistent) {
+            buffer_storage(GL_PIXEL_UNPACK_BUFFER, slot_size, nullptr, persistent_flags);
+            slot.mapped = static_cast<uint32_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_size, persistent_flags));
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_size, nullptr, GL_STREAM_DRAW);
+        }
+    }
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+bool PixelRing::upload(const GLuint texture, const TileUpload* uploads, const int count) {
+    if(count == 0)
+        return true;
+    
+    // the first slot from next on that the gpu is done with. copies into the texture are ordered by the gl
+    // command stream whichever slot they come from, so a busy slot can just be passed over
+    int free_slot = -1;
+    for(size_t i = 0; i < slots.size() && free_slot < 0; i++) {
+        const int index = (next + i) % slots.size();
+        Slot& candidate = slots[index];
+        
+        // a zero timeout only polls, presenting never waits on the gpu
+        if(candidate.fence != nullptr) {
+            const GLenum status = glClientWaitSync(candidate.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                continue;
+            
+            glDeleteSync(candidate.fence);
+            candidate.fence = nullptr;
+        }
+        
+        free_slot = index;
+    }
+    
+    if(free_slot < 0)
+        return false;
+    
+    Slot& slot = slots[free_slot];
+    
+    // uploads are packed one after another
+    GLsizeiptr size = 0;
+    for(int i = 0; i < count; i++)
+        size += (uploads[i].end - uploads[i].begin) * framebuffer_row_texels * sizeof(uint32_t);
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+    
+    uint32_t* mapped = slot.mapped;
+    if(!persistent) {
+        // the fence already says the gpu is done with it, so there's nothing for the driver to synchronise
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        mapped = static_cast<uint32_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    }
+    
+    uint32_t* texels = mapped;
+    for(int i = 0; i < count; i++) {
+        pack_framebuffer_rows(*uploads[i].state, texels, uploads[i].begin, uploads[i].end);
+        texels += (uploads[i].end - uploads[i].begin) * framebuffer_row_texels;
+    }
+    
+    if(!persistent)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    
+    // with a buffer bound the last argument is an offset into it
+    glBindTexture(GL_TEXTURE_2D, texture);
+    
+    GLsizeiptr offset = 0;
+    for(int i = 0; i < count; i++) {
+        const TileUpload& upload = uploads[i];
+        const int x = upload.tile % atlas_columns * framebuffer_row_texels;
+        const int y = upload.tile / atlas_columns * hires_screen_height + upload.begin;
+        const int rows = upload.end - upload.begin;
+        
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, framebuffer_row_texels, rows, GL_RED_INTEGER, GL_UNSIGNED_INT, reinterpret_cast<const void*>(offset));
+        offset += rows * framebuffer_row_texels * sizeof(uint32_t);
+    }
+    
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    next = (free_slot + 1) % slots.size();
+    
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "glad/glad.h"
+#include "emu.hpp"
+
+// the screen texture is an atlas of tiles, each big enough for a packed hires frame (see pack_framebuffer_rows).
+// the normal view only uses tile 0, grid view gives every machine its own.
+constexpr int atlas_columns = 32;
+constexpr int atlas_max_tiles = 1024;
+constexpr int atlas_width = atlas_columns * framebuffer_row_texels;
+constexpr int atlas_height = atlas_max_tiles / atlas_columns * hires_screen_height;
+
+// rows begin to end of state, going to a tile in the atlas
+struct TileUpload {
+    const EmulatorState* state = nullptr;
+    int tile = 0;
+    int begin = 0, end = 0;
+};
+
+// uploads packed framebuffer rows to the R32UI atlas through a ring of pixel buffer objects, so the copy into the
+// texture happens on the gpu's time instead of stalling the render thread. slots are persistently mapped when the
+// driver has ARB_buffer_storage (llvmpipe does), otherwise they're mapped unsynchronized for each upload. either
+// way a fence after each upload keeps a slot from being written again before the gpu is done reading it.
+class PixelRing {
+public:
+    // needs a current gl context
+    void create();
+    
+    // packs every upload into the next free slot and queues their copies into texture.
+    // returns false without doing anything if every slot is still in use, the rows should be tried again next frame.
+    bool upload(const GLuint texture, const TileUpload* uploads, const int count);
+
+private:
+    struct Slot {
+        GLuint buffer = 0;
+        
+        // only while persistently mapped
+        uint32_t* mapped = nullptr;
+        
+        // signalled once the gpu has finished the last upload from this slot
+        GLsync fence = nullptr;
+    };
+    
+    std::array<Slot, 3> slots;
+    int next = 0;
+    bool persistent = false;
+};
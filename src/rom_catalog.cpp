@@ -0,0 +1,279 @@
+#include "rom_catalog.hpp"
+#include "rom_pack.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+
+const char* platform_name(const Platform platform) {
+    switch(platform) {
+        case Platform::CHIP8:
+            return "CHIP-8";
+        case Platform::SCHIP:
+            return "SCHIP";
+    }
+    
+    return "";
+}
+
+uint64_t hash_rom(const uint8_t* data, const size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    
+    return hash;
+}
+
+Platform detect_platform(const uint8_t* data, const size_t size) {
+    for(size_t i = 0; i + 1 < size; i += 2) {
+        const uint16_t opcode = (data[i] << 8) | data[i + 1];
+        
+        // 00CN scroll down, 00FB-00FF scrolls, exit and resolution, FX30 big font, FX75/FX85 flags
+        const bool schip = ((opcode & 0xFFF0) == 0x00C0 && (opcode & 0xF) != 0) ||
+                           (opcode >= 0x00FB && opcode <= 0x00FF) ||
+                           ((opcode & 0xF0FF) == 0xF030) ||
+                           ((opcode & 0xF0FF) == 0xF075) ||
+                           ((opcode & 0xF0FF) == 0xF085);
+        
+        if(schip)
+            return Platform::SCHIP;
+    }
+    
+    return Platform::CHIP8;
+}
+
+void apply_quirks(const RomInfo& rom, EmuOptions& options) {
+    options.emulate_original = rom.emulate_original;
+    options.enable_anti_flicker = rom.enable_anti_flicker;
+}
+
+// reads the rom at info.path and fills in everything that comes from its contents
+bool read_rom_info(RomInfo& info) {
+    FILE* file = fopen(info.path.c_str(), "rb");
+    if(file == nullptr)
+        return false;
+    
+    uint8_t data[max_rom_size];
+    const size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    
+    if(size != info.size)
+        return false;
+    
+    info.hash = hash_rom(data, size);
+    info.platform = detect_platform(data, size);
+    
+    // new roms start out with the quirks of the interpreter their platform was written for. CHIP-8 roms expect the
+    // COSMAC VIP, which moved I past the registers in FX55/FX65, SCHIP roms the HP48 interpreters, which never did
+    const EmuOptions quirks;
+    info.emulate_original = info.platform == Platform::CHIP8;
+    info.enable_anti_flicker = quirks.enable_anti_flicker;
+    
+    return true;
+}
+
+// one rom per line after the header, "<hash> <size> <mtime> <platform> <emulate_original> <anti-flicker> <path>"
+constexpr const char* index_header = "chip8-index 1";
+
+std::vector<RomInfo> load_index(const std::string& path) {
+    std::vector<RomInfo> roms;
+    
+    std::ifstream file(path);
+    
+    std::string line;
+    if(!std::getline(file, line) || line != index_header)
+        return roms;
+    
+    while(std::getline(file, line)) {
+        std::istringstream stream(line);
+        
+        RomInfo info;
+        int platform = 0;
+        if(!(stream >> std::hex >> info.hash >> std::dec >> info.size >> info.mtime >> platform >> info.emulate_original >> info.enable_anti_flicker))
+            continue;
+        
+        stream.get();
+        std::getline(stream, info.path);
+        
+        info.platform = platform == int(Platform::SCHIP) ? Platform::SCHIP : Platform::CHIP8;
+        
+        if(!info.path.empty())
+            roms.push_back(info);
+    }
+    
+    return roms;
+}
+
+RomCatalog::~RomCatalog() {
+    wait();
+}
+
+void RomCatalog::open(const std::string& directory) {
+    wait();
+    
+    this->directory = directory;
+    
+    busy = true;
+    thread = std::thread(&RomCatalog::scan, this);
+}
+
+void RomCatalog::wait() {
+    if(thread.joinable())
+        thread.join();
+}
+
+std::vector<RomInfo> RomCatalog::entries() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return roms;
+}
+
+std::vector<std::string> RomCatalog::packs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pack_paths;
+}
+
+void RomCatalog::set_quirks(const std::string& path, const EmuOptions& options) {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    auto rom = std::find_if(roms.begin(), roms.end(), [&](const RomInfo& rom) {
+        return rom.path == path;
+    });
+    
+    if(rom == roms.end())
+        return;
+    
+    rom->emulate_original = options.emulate_original;
+    rom->enable_anti_flicker = options.enable_anti_flicker;
+    
+    save();
+    generation++;
+}
+
+void RomCatalog::scan() {
+    namespace fs = std::filesystem;
+    
+    std::vector<RomInfo> indexed = load_index(directory + "/" + index_name);
+    
+    std::unordered_map<std::string, RomInfo> cached;
+    for(auto& rom : indexed)
+        cached[rom.path] = rom;
+    
+    // what was there last time, until the directory has been checked
+    publish(std::move(indexed));
+    
+    std::error_code error;
+    if(!fs::is_directory(directory, error)) {
+        busy = false;
+        return;
+    }
+    
+    std::vector<RomInfo> found;
+    std::vector<std::string> packs;
+    
+    for(fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error), end; !error && it != end; it.increment(error)) {
+        std::error_code entry_error;
+        if(!it->is_regular_file(entry_error) || it->path().filename() == index_name)
+            continue;
+        
+        if(it->path().extension() == rom_pack_extension) {
+            packs.push_back(it->path().string());
+            continue;
+        }
+        
+        RomInfo info;
+        info.path = it->path().string();
+        info.size = it->file_size(entry_error);
+        info.mtime = it->last_write_time(entry_error).time_since_epoch().count();
+        
+        // too big to load, or couldn't be looked at
+        if(entry_error || info.size == 0 || info.size > max_rom_size)
+            continue;
+        
+        auto rom = cached.find(info.path);
+        if(rom != cached.end() && rom->second.size == info.size && rom->second.mtime == info.mtime) {
+            found.push_back(rom->second);
+            continue;
+        }
+        
+        if(read_rom_info(info))
+            found.push_back(info);
+    }
+    
+    std::sort(packs.begin(), packs.end());
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pack_paths = std::move(packs);
+    }
+    
+    publish(std::move(found));
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!save())
+            fprintf(stderr, "couldn't save the rom index in %s\n", directory.c_str());
+    }
+    
+    busy = false;
+}
+
+void RomCatalog::publish(std::vector<RomInfo> found) {
+    std::sort(found.begin(), found.end(), [](const RomInfo& a, const RomInfo& b) {
+        return a.path < b.path;
+    });
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    // quirks set since the scan started win, as long as it's still the same rom
+    std::unordered_map<std::string, const RomInfo*> previous;
+    for(auto& rom : roms)
+        previous[rom.path] = &rom;
+    
+    for(auto& rom : found) {
+        auto before = previous.find(rom.path);
+        if(before != previous.end() && before->second->hash == rom.hash) {
+            rom.emulate_original = before->second->emulate_original;
+            rom.enable_anti_flicker = before->second->enable_anti_flicker;
+        }
+    }
+    
+    roms = std::move(found);
+    generation++;
+}
+
+bool RomCatalog::save() const {
+    // written next to the index and moved over it, so a crash never leaves half an index behind
+    const std::string path = directory + "/" + index_name;
+    const std::string temporary = path + ".tmp";
+    
+    FILE* file = fopen(temporary.c_str(), "w");
+    if(file == nullptr)
+        return false;
+    
+    fprintf(file, "%s\n", index_header);
+    
+    for(auto& rom : roms) {
+        fprintf(file,
+                "%016llx %llu %lld %d %d %d %s\n",
+                (unsigned long long)rom.hash,
+                (unsigned long long)rom.size,
+                (long long)rom.mtime,
+                int(rom.platform),
+                rom.emulate_original,
+                rom.enable_anti_flicker,
+                rom.path.c_str());
+    }
+    
+    if(fclose(file) != 0)
+        return false;
+    
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    
+    return !error;
+}
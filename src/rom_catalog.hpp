@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emu.hpp"
+
+enum class Platform : uint8_t {
+    CHIP8,
+    SCHIP
+};
+
+const char* platform_name(const Platform platform);
+
+struct RomInfo {
+    std::string path;
+    uint64_t size = 0;
+    
+    // last write time, an entry is only hashed again once this or the size changes
+    int64_t mtime = 0;
+    
+    uint64_t hash = 0;
+    Platform platform = Platform::CHIP8;
+    
+    // the quirks it runs with, picked from the platform until they're changed for this rom
+    bool emulate_original = false;
+    bool enable_anti_flicker = true;
+};
+
+// FNV-1a, roms are at most max_rom_size so anything fancier wouldn't be measurable next to reading them
+uint64_t hash_rom(const uint8_t* data, const size_t size);
+
+// SCHIP if any of the instructions only SCHIP has show up, looking at every even offset
+Platform detect_platform(const uint8_t* data, const size_t size);
+
+// copies the quirks a rom runs with into options, leaving the rest alone
+void apply_quirks(const RomInfo& rom, EmuOptions& options);
+
+// every rom in a directory and below it, scanned on a background thread. what's found is kept in an index file in
+// the directory, so the next scan only has to read roms that were added or changed since, and the entries from
+// the index are available straight away while that happens.
+class RomCatalog {
+public:
+    ~RomCatalog();
+    
+    // starts scanning directory, waiting for any scan that's still running first
+    void open(const std::string& directory);
+    
+    // blocks until the scan is done
+    void wait();
+    
+    bool scanning() const {
+        return busy;
+    }
+    
+    // goes up whenever the entries change, so they only have to be copied then
+    uint64_t version() const {
+        return generation;
+    }
+    
+    // sorted by path
+    std::vector<RomInfo> entries() const;
+    
+    // rom packs in the directory, they aren't opened by the scan so they show up once it's done
+    std::vector<std::string> packs() const;
+    
+    // remembers the quirks in options for the rom at path and saves the index
+    void set_quirks(const std::string& path, const EmuOptions& options);
+    
+    // kept in the scanned directory, and skipped by the scan
+    static constexpr const char* index_name = ".chip8-index";
+
+private:
+    void scan();
+    void publish(std::vector<RomInfo> found);
+    
+    // with mutex held
+    bool save() const;
+    
+    std::string directory;
+    std::thread thread;
+    
+    mutable std::mutex mutex;
+    std::vector<RomInfo> roms;
+    std::vector<std::string> pack_paths;
+    
+    std::atomic<uint64_t> generation = 0;
+    std::atomic<bool> busy = false;
+};
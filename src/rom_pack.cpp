@@ -0,0 +1,207 @@
+#include "rom_pack.hpp"
+#include "rom_catalog.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr char pack_magic[8] = {'C', 'H', '8', 'P', 'A', 'C', 'K', '1'};
+constexpr size_t pack_header_size = 16;
+constexpr size_t pack_entry_size = 24;
+
+uint32_t read_u32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+uint64_t read_u64(const uint8_t* data) {
+    return read_u32(data) | (uint64_t(read_u32(data + 4)) << 32);
+}
+
+void write_u32(std::vector<uint8_t>& out, const uint32_t value) {
+    for(int i = 0; i < 4; i++)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+void write_u64(std::vector<uint8_t>& out, const uint64_t value) {
+    write_u32(out, value & 0xFFFFFFFF);
+    write_u32(out, value >> 32);
+}
+
+RomPack::~RomPack() {
+    close();
+}
+
+bool RomPack::open(const char* path) {
+    close();
+    
+    const int file = ::open(path, O_RDONLY);
+    if(file < 0)
+        return false;
+    
+    struct stat info = {};
+    if(fstat(file, &info) != 0 || size_t(info.st_size) < pack_header_size) {
+        ::close(file);
+        return false;
+    }
+    
+    void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    
+    if(memory == MAP_FAILED)
+        return false;
+    
+    mapped = static_cast<const uint8_t*>(memory);
+    mapped_size = info.st_size;
+    
+    const uint64_t entry_count = read_u32(mapped + 8);
+    bool valid = memcmp(mapped, pack_magic, sizeof(pack_magic)) == 0 &&
+                 pack_header_size + entry_count * pack_entry_size <= mapped_size;
+    
+    // so entry() and find() never have to check anything
+    for(uint32_t i = 0; valid && i < entry_count; i++) {
+        const uint8_t* entry = mapped + pack_header_size + i * pack_entry_size;
+        const uint64_t offset = read_u32(entry + 8), size = read_u32(entry + 12);
+        const uint64_t name_offset = read_u32(entry + 16), name_size = read_u32(entry + 20);
+        
+        valid = offset + size <= mapped_size && size <= max_rom_size && name_offset + name_size <= mapped_size;
+    }
+    
+    if(!valid) {
+        close();
+        return false;
+    }
+    
+    count = entry_count;
+    
+    return true;
+}
+
+void RomPack::close() {
+    if(mapped != nullptr)
+        munmap(const_cast<uint8_t*>(mapped), mapped_size);
+    
+    mapped = nullptr;
+    mapped_size = 0;
+    count = 0;
+}
+
+PackEntry RomPack::entry(const size_t index) const {
+    const uint8_t* entry = mapped + pack_header_size + index * pack_entry_size;
+    
+    PackEntry result;
+    result.hash = read_u64(entry);
+    result.data = mapped + read_u32(entry + 8);
+    result.size = read_u32(entry + 12);
+    result.name = std::string_view(reinterpret_cast<const char*>(mapped + read_u32(entry + 16)), read_u32(entry + 20));
+    
+    return result;
+}
+
+bool RomPack::find(const std::string_view name, PackEntry& entry) const {
+    size_t begin = 0, end = count;
+    while(begin < end) {
+        const size_t middle = begin + (end - begin) / 2;
+        const PackEntry candidate = this->entry(middle);
+        
+        if(candidate.name == name) {
+            entry = candidate;
+            return true;
+        }
+        
+        if(candidate.name < name)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    
+    return false;
+}
+
+int build_rom_pack(const char* directory, const char* output) {
+    namespace fs = std::filesystem;
+    
+    struct PackedRom {
+        std::string name;
+        std::vector<uint8_t> data;
+    };
+    
+    std::vector<PackedRom> roms;
+    
+    std::error_code error;
+    for(fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error), end; !error && it != end; it.increment(error)) {
+        std::error_code entry_error;
+        const fs::path& path = it->path();
+        
+        // the catalog's index and other packs aren't roms
+        if(!it->is_regular_file(entry_error) || path.filename() == RomCatalog::index_name || path.extension() == rom_pack_extension)
+            continue;
+        
+        const auto size = it->file_size(entry_error);
+        if(entry_error || size == 0 || size > max_rom_size)
+            continue;
+        
+        PackedRom rom;
+        rom.name = path.lexically_relative(directory).generic_string();
+        rom.data.resize(size);
+        
+        FILE* file = fopen(path.c_str(), "rb");
+        if(file == nullptr)
+            continue;
+        
+        const bool read = fread(rom.data.data(), 1, size, file) == size;
+        fclose(file);
+        
+        if(read)
+            roms.push_back(std::move(rom));
+    }
+    
+    std::sort(roms.begin(), roms.end(), [](const PackedRom& a, const PackedRom& b) {
+        return a.name < b.name;
+    });
+    
+    size_t names_size = 0;
+    for(auto& rom : roms)
+        names_size += rom.name.size();
+    
+    std::vector<uint8_t> pack(pack_magic, pack_magic + sizeof(pack_magic));
+    write_u32(pack, roms.size());
+    write_u32(pack, 0);
+    
+    uint32_t name_offset = pack_header_size + roms.size() * pack_entry_size;
+    uint32_t data_offset = name_offset + names_size;
+    
+    for(auto& rom : roms) {
+        write_u64(pack, hash_rom(rom.data.data(), rom.data.size()));
+        write_u32(pack, data_offset);
+        write_u32(pack, rom.data.size());
+        write_u32(pack, name_offset);
+        write_u32(pack, rom.name.size());
+        
+        name_offset += rom.name.size();
+        data_offset += rom.data.size();
+    }
+    
+    for(auto& rom : roms)
+        pack.insert(pack.end(), rom.name.begin(), rom.name.end());
+    
+    for(auto& rom : roms)
+        pack.insert(pack.end(), rom.data.begin(), rom.data.end());
+    
+    FILE* file = fopen(output, "wb");
+    if(file == nullptr)
+        return -1;
+    
+    const bool written = fwrite(pack.data(), 1, pack.size(), file) == pack.size();
+    if(fclose(file) != 0 || !written)
+        return -1;
+    
+    return roms.size();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// many roms in one file, so loading them is a copy out of a mapping instead of an open and read per rom.
+// all little endian:
+//   header   "CH8PACK1", u32 entry count, u32 reserved
+//   entries  u64 hash (see hash_rom), u32 data offset, u32 size, u32 name offset, u32 name size, sorted by name
+//   names    every name, relative to the packed directory with / between directories
+//   data     every rom, back to back
+constexpr std::string_view rom_pack_extension = ".ch8pack";
+
+struct PackEntry {
+    std::string_view name;
+    uint64_t hash = 0;
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+};
+
+// a pack mapped read only. entries point straight into the mapping, so they're only valid while it's open
+class RomPack {
+public:
+    RomPack() = default;
+    ~RomPack();
+    
+    RomPack(const RomPack&) = delete;
+    RomPack& operator=(const RomPack&) = delete;
+    
+    // returns false if the file can't be mapped or isn't a valid pack, every offset is checked here once
+    bool open(const char* path);
+    void close();
+    
+    size_t size() const {
+        return count;
+    }
+    
+    PackEntry entry(const size_t index) const;
+    
+    // binary search by name
+    bool find(const std::string_view name, PackEntry& entry) const;
+
+private:
+    const uint8_t* mapped = nullptr;
+    size_t mapped_size = 0;
+    uint32_t count = 0;
+};
+
+// packs every rom in directory and below it into output, returns how many or -1 if output couldn't be written
+int build_rom_pack(const char* directory, const char* output);
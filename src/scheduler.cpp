@@ -0,0 +1,102 @@
+#include "scheduler.hpp"
+#include "emu.hpp"
+#include "beeper.hpp"
+
+#include <algorithm>
+
+uint64_t Scheduler::advance(Machine& machine, const clock::time_point now, InputQueue* input, Beeper* beeper) {
+    if(!started)
+        restart(now);
+    
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - epoch).count();
+    const uint64_t due = elapsed > 0 ? (uint64_t(elapsed) * ticks_per_second) / 1'000'000'000 : 0;
+    
+    // too far behind to catch up, so skip ahead and keep the timing of the ticks after that
+    if(due > scheduled_ticks + max_catch_up_ticks) {
+        dropped_ticks += due - scheduled_ticks - max_catch_up_ticks;
+        scheduled_ticks = due - max_catch_up_ticks;
+    }
+    
+    uint64_t executed = 0;
+    for(; scheduled_ticks < due; scheduled_ticks++) {
+        remainder += instructions_per_second;
+        
+        const uint32_t batch = remainder / ticks_per_second;
+        remainder %= ticks_per_second;
+        
+        uint32_t done = 0;
+        
+        // the tick's samples, split between its instructions the same way as input events
+        const uint64_t first_sample = beeper != nullptr ? ticks * beeper->sample_rate / ticks_per_second : 0;
+        const uint64_t last_sample = beeper != nullptr ? (ticks + 1) * beeper->sample_rate / ticks_per_second : 0;
+        
+        auto run_to = [&](const uint32_t at) {
+            if(at == done)
+                return;
+            
+            if(beeper != nullptr) {
+                const uint64_t samples = last_sample - first_sample;
+                beeper->run(machine, at - done, first_sample + samples * done / batch, first_sample + samples * at / batch);
+            } else {
+                machine.run(at - done);
+            }
+            
+            done = at;
+        };
+        
+        if(input != nullptr) {
+            const auto start = tick_time(scheduled_ticks), end = tick_time(scheduled_ticks + 1);
+            const int64_t length = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            
+            // each instruction of the batch stands for an equal share of the tick, events from before the tick
+            // started (ticks that got dropped) go in first
+            for(const InputEvent* event = input->peek(); event != nullptr && event->time < end; event = input->peek()) {
+                const int64_t offset = std::chrono::duration_cast<std::chrono::nanoseconds>(event->time - start).count();
+                const uint32_t at = std::max<int64_t>(offset * batch / length, done);
+                
+                run_to(at);
+                
+                machine.state.keys[event->key] = event->pressed;
+                input->pop();
+            }
+        }
+        
+        run_to(batch);
+        machine.tick_timers();
+        
+        if(beeper != nullptr) {
+            beeper->gate(machine.state.sound_timer > 0, last_sample);
+            beeper->flush(last_sample);
+        }
+        
+        executed += batch;
+        ticks++;
+    }
+    
+    return executed;
+}
+
+Scheduler::clock::time_point Scheduler::next_tick() const {
+    return tick_time(scheduled_ticks + 1);
+}
+
+// the first moment the tick is due, rounded up to match advance
+Scheduler::clock::time_point Scheduler::tick_time(const uint64_t tick) const {
+    const uint64_t nanoseconds = (tick * 1'000'000'000 + ticks_per_second - 1) / ticks_per_second;
+    
+    return epoch + std::chrono::nanoseconds(nanoseconds);
+}
+
+void Scheduler::restart(const clock::time_point now) {
+    started = true;
+    epoch = now;
+    scheduled_ticks = 0;
+    remainder = 0;
+}
+
+void apply_input(Machine& machine, InputQueue& input, const Scheduler::clock::time_point until) {
+    for(const InputEvent* event = input.peek(); event != nullptr && event->time < until; event = input.peek()) {
+        machine.state.keys[event->key] = event->pressed;
+        input.pop();
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "spsc_ring.hpp"
+
+struct Machine;
+class Beeper;
+
+// a key going down or up, stamped with when it happened on the scheduler's clock
+struct InputEvent {
+    std::chrono::steady_clock::time_point time;
+    uint8_t key = 0;
+    bool pressed = false;
+};
+
+// key events from the thread handling input to the one running the machine
+typedef SpscRing<InputEvent, 256> InputQueue;
+
+// what the gui runs at until it's changed, and what headless runs are paced at by default
+constexpr uint32_t default_instructions_per_second = 700;
+
+// runs a machine in real time, independent of how often it gets called. the cpu runs instructions_per_second
+// spread over 60 Hz ticks, and both timers tick once per tick. ticks are counted from a fixed starting point
+// so they don't drift, and when the host falls too far behind the missed ticks are dropped instead of
+// running all at once.
+struct Scheduler {
+    typedef std::chrono::steady_clock clock;
+    
+    static constexpr int ticks_per_second = 60;
+    
+    // runs every tick that's due by now, returns how many instructions were executed.
+    // events from input go in at the instruction of the tick that lines up with when they happened, so key timing
+    // doesn't depend on how often this gets called. events from after the ticks that ran stay queued.
+    // with a beeper the instructions run one at a time, so the tone starts and stops at the sample of the instruction
+    // that changed it. its samples count from the first tick this scheduler ran.
+    uint64_t advance(Machine& machine, const clock::time_point now, InputQueue* input = nullptr, Beeper* beeper = nullptr);
+    
+    // starts counting ticks from now, for when the machine has been paused or reset
+    void restart(const clock::time_point now);
+    
+    // when the next tick is due, for sleeping until there's something to run
+    clock::time_point next_tick() const;
+    
+    uint32_t instructions_per_second = default_instructions_per_second;
+    
+    // ticks to catch up on at most, anything further behind is dropped
+    uint64_t max_catch_up_ticks = 6;
+    
+    uint64_t ticks = 0, dropped_ticks = 0;
+
+private:
+    clock::time_point tick_time(const uint64_t tick) const;
+    
+    bool started = false;
+    clock::time_point epoch;
+    
+    // ticks since epoch, which is ticks plus any dropped since the last restart
+    uint64_t scheduled_ticks = 0;
+    
+    // leftover instructions per second that didn't divide evenly into ticks
+    uint32_t remainder = 0;
+};
+
+// applies every queued event from before until at once, for when the machine isn't being run by a scheduler
+void apply_input(Machine& machine, InputQueue& input, const Scheduler::clock::time_point until);
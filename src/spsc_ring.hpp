@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// a fixed size queue from one producer thread to one consumer thread, neither of them ever waits or allocates.
+// Capacity has to be a power of two, the indices just count up and wrap into the buffer with a mask.
+template<typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity has to be a power of two");
+
+public:
+    // producer side, returns false without doing anything when the ring is full
+    bool push(const T& value) {
+        const size_t tail = write_index.load(std::memory_order_relaxed);
+        if(tail - read_index.load(std::memory_order_acquire) == Capacity)
+            return false;
+        
+        buffer[tail & (Capacity - 1)] = value;
+        write_index.store(tail + 1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    // consumer side, the oldest value or nullptr when the ring is empty. it stays valid until pop()
+    const T* peek() const {
+        const size_t head = read_index.load(std::memory_order_relaxed);
+        if(head == write_index.load(std::memory_order_acquire))
+            return nullptr;
+        
+        return &buffer[head & (Capacity - 1)];
+    }
+    
+    // drops the value peek() returned
+    void pop() {
+        read_index.store(read_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    // how much is queued, only exact from one of the two threads while the other is idle
+    size_t size() const {
+        return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, Capacity> buffer = {};
+    
+    // kept on separate cache lines so the two threads don't keep taking the line off each other
+    alignas(64) std::atomic<size_t> write_index = 0;
+    alignas(64) std::atomic<size_t> read_index = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// hands the newest value from one writer thread to one reader thread without either of them ever waiting.
+// the writer fills write_buffer() and publishes it, the reader picks up whatever was published last with update()
+// and reads it through read_buffer(). values published in between are skipped, never torn.
+template<typename T>
+class TripleBuffer {
+public:
+    // writer side, the buffer being filled in. it still holds whatever was in it when it was last swapped out
+    T& write_buffer() {
+        return buffers[back];
+    }
+    
+    void publish() {
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+    
+    // reader side, switches to the newest published buffer if there is one and returns whether there was
+    bool update() {
+        if((middle.load(std::memory_order_relaxed) & fresh_bit) == 0)
+            return false;
+        
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    
+    const T& read_buffer() const {
+        return buffers[front];
+    }
+
+private:
+    static constexpr uint8_t index_mask = 0x3, fresh_bit = 0x4;
+    
+    std::array<T, 3> buffers = {};
+    
+    // the buffer that's been handed over but not picked up yet, with fresh_bit set if it was published since the
+    // reader last looked
+    std::atomic<uint8_t> middle = 1;
+    
+    uint8_t back = 0, front = 2;
+};
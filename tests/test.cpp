@@ -2,177 +2,1457 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
 #include "emu.hpp"
+#include "scheduler.hpp"
+#include "disassembler.hpp"
+#include "triple_buffer.hpp"
+#include "beeper.hpp"
+#include "rom_catalog.hpp"
+#include "rom_pack.hpp"
+#include "compiler.hpp"
 
-TEST_CASE("Test 0x1") {
-    state.reset();
+#ifdef CHIP8_LOCKSTEP
+#include "lockstep.hpp"
+#endif
 
-    process_opcode(0x1100);
+TEST_CASE("Test 0x1") {
+    Machine machine;
     
-    CHECK(state.PC == 0x100);
+    machine.process_opcode(0x1100);
+    
+    CHECK(machine.state.PC == 0x100);
 }
 
 TEST_CASE("Test 0x3") {
-    state.reset();
+    Machine machine;
     
     // set v[1] to 1
-    process_opcode(0x6101);
+    machine.process_opcode(0x6101);
     
     // should skip if v[1] == 1
-    process_opcode(0x3101);
-    CHECK(state.PC == 0x206);
+    machine.process_opcode(0x3101);
+    CHECK(machine.state.PC == 0x206);
     
     // should not skip since v[1] != 2
-    process_opcode(0x3102);
-    CHECK(state.PC == 0x208);
+    machine.process_opcode(0x3102);
+    CHECK(machine.state.PC == 0x208);
 }
 
 TEST_CASE("Test 0x4") {
-    state.reset();
+    Machine machine;
     
     // set v[1] to 1
-    process_opcode(0x6101);
+    machine.process_opcode(0x6101);
     
     // should not skip since v[1] == 1
-    process_opcode(0x4101);
-    CHECK(state.PC == 0x204);
+    machine.process_opcode(0x4101);
+    CHECK(machine.state.PC == 0x204);
     
     // should skip since v[1] != 2
-    process_opcode(0x4102);
-    CHECK(state.PC == 0x208);
+    machine.process_opcode(0x4102);
+    CHECK(machine.state.PC == 0x208);
 }
 
 TEST_CASE("Test 0x6") {
-    state.reset();
+    Machine machine;
     
-    process_opcode(0x6199);
+    machine.process_opcode(0x6199);
     
-    CHECK(state.v[1] == 0x99);
-    CHECK(state.PC == 0x202);
+    CHECK(machine.state.v[1] == 0x99);
+    CHECK(machine.state.PC == 0x202);
 }
 
 TEST_CASE("Test 0x7") {
-    state.reset();
+    Machine machine;
     
     // add 1 + 1
-    process_opcode(0x7101);
-    process_opcode(0x7101);
+    machine.process_opcode(0x7101);
+    machine.process_opcode(0x7101);
     
-    CHECK(state.v[1] == 0x02);
-    CHECK(state.PC == 0x204);
+    CHECK(machine.state.v[1] == 0x02);
+    CHECK(machine.state.PC == 0x204);
 }
 
 TEST_CASE("Test 0x8XY0") {
-    state.reset();
+    Machine machine;
     
     // set v[1] to 3
-    process_opcode(0x6103);
+    machine.process_opcode(0x6103);
     
     // set v[2] = 4
-    process_opcode(0x6204);
+    machine.process_opcode(0x6204);
     
     // set v[1] to v[2]
-    process_opcode(0x8120);
+    machine.process_opcode(0x8120);
     
-    CHECK(state.v[1] == 0x04);
-    CHECK(state.PC == 0x206);
+    CHECK(machine.state.v[1] == 0x04);
+    CHECK(machine.state.PC == 0x206);
 }
 
 TEST_CASE("Test 0xA") {
-    state.reset();
+    Machine machine;
     
-    process_opcode(0xABCD);
+    machine.process_opcode(0xABCD);
     
-    CHECK(state.I == 0xBCD);
-    CHECK(state.PC == 0x202);
+    CHECK(machine.state.I == 0xBCD);
+    CHECK(machine.state.PC == 0x202);
 }
 
 // TODO: find a way to test this!!
 TEST_CASE("Test 0xC") {
-    state.reset();
+    Machine machine;
     
-    process_opcode(0xC122);
+    machine.process_opcode(0xC122);
     
-    CHECK(state.PC == 0x202);
+    CHECK(machine.state.PC == 0x202);
 }
 
 TEST_CASE("Test 0xFX07") {
-    state.reset();
+    Machine machine;
     
-    state.delay_timer = 5;
+    machine.state.delay_timer = 5;
     
-    process_opcode(0xF107);
+    machine.process_opcode(0xF107);
     
-    CHECK(state.v[1] == 0x5);
-    CHECK(state.PC == 0x202);
+    CHECK(machine.state.v[1] == 0x5);
+    CHECK(machine.state.PC == 0x202);
 }
 
 TEST_CASE("Test 0xFX1E") {
     SUBCASE("") {
-        state.reset();
+        Machine machine;
         
-        state.I = 5;
+        machine.state.I = 5;
         
         // set v[1] to 5
-        process_opcode(0x6105);
+        machine.process_opcode(0x6105);
         
-        process_opcode(0xF11E);
+        machine.process_opcode(0xF11E);
         
-        CHECK(state.I == 10);
-        CHECK(state.PC == 0x204);
+        CHECK(machine.state.I == 10);
+        CHECK(machine.state.PC == 0x204);
     }
     
     SUBCASE("Overflow") {
-        state.reset();
+        Machine machine;
         
-        state.I = 4095;
+        machine.state.I = 4095;
         
         // set v[1] to 5
-        process_opcode(0x6125);
+        machine.process_opcode(0x6125);
         
-        process_opcode(0xF11E);
+        machine.process_opcode(0xF11E);
         
-        CHECK(state.v[0xF] == 1);
-        CHECK(state.PC == 0x204);
+        CHECK(machine.state.v[0xF] == 1);
+        CHECK(machine.state.PC == 0x204);
     }
 }
 
 TEST_CASE("Test 0x33") {
     SUBCASE("Zero") {
-        state.reset();
+        Machine machine;
         
-        process_opcode(0xF133);
+        machine.process_opcode(0xF133);
         
-        CHECK(state.memory[state.I] == 0);
-        CHECK(state.PC == 0x202);
+        CHECK(machine.state.memory[machine.state.I] == 0);
+        CHECK(machine.state.PC == 0x202);
     }
     
     SUBCASE("Larger than Zero") {
-        state.reset();
+        Machine machine;
         
         // store 0x65 == 101
-        process_opcode(0x6165);
+        machine.process_opcode(0x6165);
         
-        process_opcode(0xF133);
-
-        CHECK(state.memory[state.I] == 1);
-        CHECK(state.memory[state.I + 1] == 0);
-        CHECK(state.memory[state.I + 2] == 1);
-        CHECK(state.PC == 0x204);
+        machine.process_opcode(0xF133);
+        
+        CHECK(machine.state.memory[machine.state.I] == 1);
+        CHECK(machine.state.memory[machine.state.I + 1] == 0);
+        CHECK(machine.state.memory[machine.state.I + 2] == 1);
+        CHECK(machine.state.PC == 0x204);
     }
 }
 
 TEST_CASE("Test 0x65") {
-    state.reset();
+    Machine machine;
+    
+    machine.state.memory[machine.state.I] = 0x1;
+    machine.state.memory[machine.state.I + 1] = 0x2;
+    machine.state.memory[machine.state.I + 2] = 0x3;
+    
+    machine.process_opcode(0xF265);
+    
+    CHECK(machine.state.v[0] == 0x1);
+    CHECK(machine.state.v[1] == 0x2);
+    CHECK(machine.state.v[2] == 0x3);
+    CHECK(machine.state.PC == 0x202);
+}
+
+TEST_CASE("Test 0xD") {
+    Machine machine;
+    
+    machine.state.memory[0x300] = 0xF0;
+    machine.state.memory[0x301] = 0x81;
+    machine.state.I = 0x300;
+    
+    SUBCASE("Wraps around the edges") {
+        // draw 2 rows at 60, 31
+        machine.state.v[0] = 60;
+        machine.state.v[1] = 31;
+        machine.process_opcode(0xD012);
+        
+        CHECK(machine.state.framebuffer[31][0] == 0x000000000000000F);
+        CHECK(machine.state.framebuffer[0][0] == 0x1000000000000008);
+        CHECK(machine.state.v[0xF] == 0);
+        
+        uint8_t pixels[screen_width * screen_height] = {};
+        expand_framebuffer(machine.state, pixels);
+        
+        CHECK(pixels[to_coord(63, 31)] == 1);
+        CHECK(pixels[to_coord(59, 31)] == 0);
+        CHECK(pixels[to_coord(3, 0)] == 1);
+        CHECK(pixels[to_coord(4, 0)] == 0);
+        
+        uint32_t texels[framebuffer_row_texels * 2] = {};
+        pack_framebuffer_rows(machine.state, texels, 0, 2);
+        
+        CHECK(texels[0] == 0x10000000);
+        CHECK(texels[1] == 0x00000008);
+        CHECK(texels[2] == 0);
+        CHECK(texels[4] == 0);
+    }
+    
+    SUBCASE("Collides and erases") {
+        machine.process_opcode(0xD012);
+        machine.process_opcode(0xD011);
+        
+        CHECK(machine.state.v[0xF] == 1);
+        CHECK(machine.state.framebuffer[0][0] == 0);
+        CHECK(machine.state.framebuffer[1][0] == 0x8100000000000000);
+        
+        machine.process_opcode(0x00E0);
+        CHECK(machine.state.framebuffer[1][0] == 0);
+    }
+    
+    SUBCASE("Marks the rows it touched dirty") {
+        machine.state.dirty_begin = machine.state.dirty_end = 0;
+        
+        machine.state.v[1] = 10;
+        machine.process_opcode(0xD012);
+        
+        CHECK(machine.state.dirty_begin == 10);
+        CHECK(machine.state.dirty_end == 12);
+        
+        machine.state.v[1] = 4;
+        machine.process_opcode(0xD011);
+        
+        CHECK(machine.state.dirty_begin == 4);
+        CHECK(machine.state.dirty_end == 12);
+        
+        // wrapping past the bottom
+        machine.state.dirty_begin = machine.state.dirty_end = 0;
+        machine.state.v[1] = 31;
+        machine.process_opcode(0xD012);
+        
+        CHECK(machine.state.dirty_begin == 0);
+        CHECK(machine.state.dirty_end == 32);
+    }
+}
+
+TEST_CASE("Test SCHIP") {
+    Machine machine;
+    
+    machine.state.memory[0x300] = 0xF0;
+    machine.state.memory[0x301] = 0x81;
+    machine.state.I = 0x300;
+    
+    SUBCASE("Switches resolution") {
+        machine.process_opcode(0xD011);
+        machine.process_opcode(0x00FF);
+        
+        CHECK(machine.state.hires);
+        CHECK(machine.state.width() == 128);
+        CHECK(machine.state.height() == 64);
+        CHECK(machine.state.framebuffer[0][0] == 0);
+        CHECK(machine.state.PC == 0x204);
+        
+        machine.process_opcode(0x00FE);
+        CHECK(!machine.state.hires);
+        CHECK(machine.state.width() == 64);
+    }
+    
+    SUBCASE("Draws across both words in hires") {
+        machine.process_opcode(0x00FF);
+        
+        // draw 1 row at 124, 63
+        machine.state.v[0] = 124;
+        machine.state.v[1] = 63;
+        machine.process_opcode(0xD011);
+        
+        CHECK(machine.state.framebuffer[63][1] == 0x000000000000000F);
+        CHECK(machine.state.framebuffer[63][0] == 0);
+        
+        machine.state.v[0] = 60;
+        machine.process_opcode(0xD011);
+        
+        CHECK(machine.state.framebuffer[63][0] == 0x000000000000000F);
+        CHECK(machine.state.v[0xF] == 0);
+    }
+    
+    SUBCASE("DXY0 draws 16x16 in hires") {
+        machine.state.memory[0x31F] = 0x01;
+        machine.process_opcode(0x00FF);
+        machine.process_opcode(0xD010);
+        
+        CHECK(machine.state.framebuffer[0][0] == 0xF081000000000000);
+        CHECK(machine.state.framebuffer[15][0] == 0x0001000000000000);
+        CHECK(machine.state.framebuffer[16][0] == 0);
+    }
+    
+    SUBCASE("Scrolls") {
+        machine.process_opcode(0xD011);
+        
+        machine.process_opcode(0x00C2);
+        CHECK(machine.state.framebuffer[0][0] == 0);
+        CHECK(machine.state.framebuffer[2][0] == 0xF000000000000000);
+        
+        machine.process_opcode(0x00FB);
+        CHECK(machine.state.framebuffer[2][0] == 0x0F00000000000000);
+        
+        machine.process_opcode(0x00FC);
+        machine.process_opcode(0x00FC);
+        CHECK(machine.state.framebuffer[2][0] == 0);
+        
+        machine.state.v[0] = 60;
+        machine.process_opcode(0xD011);
+        machine.process_opcode(0x00FB);
+        
+        // low resolution drops what leaves the right edge
+        CHECK(machine.state.framebuffer[0][0] == 0);
+        CHECK(machine.state.framebuffer[0][1] == 0);
+        
+        CHECK(machine.state.PC == 0x20E);
+    }
+}
+
+TEST_CASE("Disassembler") {
+    char text[disassembly_text_size];
+    
+    auto check = [&](const uint16_t opcode, const char* expected) {
+        disassemble(opcode, text);
+        CHECK(std::string(text) == expected);
+    };
+    
+    check(0x00E0, "CLS");
+    check(0x00C4, "SCD 4");
+    check(0x00FF, "HIGH");
+    check(0x0123, "SYS 0x123");
+    check(0x2ABC, "CALL 0xABC");
+    check(0x3F12, "SE VF, 0x12");
+    check(0x5120, "SE V1, V2");
+    check(0x5121, "DW 0x5121");
+    check(0x8AB1, "OR VA, VB");
+    check(0x8ABE, "SHL VA, VB");
+    check(0x8AB8, "DW 0x8AB8");
+    check(0xB200, "JP V0, 0x200");
+    check(0xD01F, "DRW V0, V1, 15");
+    check(0xE3A1, "SKNP V3");
+    check(0xF265, "LD V2, [I]");
+    check(0xF285, "LD V2, R");
+    check(0xF2FF, "DW 0xF2FF");
+    
+    SUBCASE("Cached text follows writes") {
+        Machine machine;
+        machine.reset();
+        
+        // I = 0x202, v[0] = 0x60, store v[0]
+        const uint8_t program[] = {0xA2, 0x02, 0x60, 0x60, 0xF0, 0x55};
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        CHECK(std::string(machine.disassemble(0x202)) == "LD V0, 0x60");
+        CHECK(std::string(machine.disassemble(0x201)) == "SYS 0x260");
+        
+        machine.run(3);
+        
+        CHECK(std::string(machine.disassemble(0x202)) == "LD V0, 0x60");
+        CHECK(std::string(machine.disassemble(0x201)) == "SYS 0x260");
+        
+        // writing 0x61 over the first byte of 0x202 changes it and the opcode straddling it
+        machine.state.v[0] = 0x61;
+        machine.state.PC = 0x204;
+        machine.run(1);
+        
+        CHECK(std::string(machine.disassemble(0x202)) == "LD V1, 0x60");
+        CHECK(std::string(machine.disassemble(0x201)) == "SYS 0x261");
+    }
+}
+
+void write_file(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+TEST_CASE("Compiler") {
+    Machine machine;
+    
+    SUBCASE("Runs a loop with a variable") {
+        const CompiledProgram program = compile(
+            "var count = 3;\n"
+            "label(main);\n"
+            "count += 3;\n"
+            "draw_char(0, 5, count);\n"
+            "jump(main);\n");
+        
+        REQUIRE(program.error.empty());
+        
+        // count stays in v0 the whole time, and the numbers go through temporaries from the top
+        CHECK(program.rom == std::vector<uint8_t>{
+            0x60, 0x03,
+            0x70, 0x03, 0x6E, 0x00, 0x6D, 0x05, 0xF0, 0x29, 0xDE, 0xD5, 0x12, 0x02
+        });
+        
+        machine.load_rom(program.rom.data(), program.rom.size());
+        machine.run(1);
+        
+        // one time around the loop
+        int instructions = 0;
+        do {
+            machine.step();
+            instructions++;
+        } while(machine.state.PC != 0x202);
+        
+        CHECK(instructions == 6);
+        CHECK(machine.state.v[0] == 6);
+        
+        machine.run(6);
+        CHECK(machine.state.v[0] == 9);
+    }
+    
+    SUBCASE("Jumps to labels defined later") {
+        const CompiledProgram program = compile("jump(end); v[1] = 1; label(end); v[2] = 0x2;");
+        
+        REQUIRE(program.error.empty());
+        CHECK(program.rom == std::vector<uint8_t>{0x12, 0x04, 0x61, 0x01, 0x62, 0x02});
+    }
+    
+    SUBCASE("Adds variables together") {
+        const CompiledProgram program = compile("var a = 1; var b = 2; // both in memory\na += b; v[5] = a;");
+        
+        REQUIRE(program.error.empty());
+        
+        machine.load_rom(program.rom.data(), program.rom.size());
+        machine.run(program.rom.size() / 2);
+        
+        CHECK(machine.state.v[5] == 3);
+    }
+    
+    SUBCASE("Spills the variables live longest when registers run out") {
+        // all 16 are live at once, with v1 taken by the program
+        std::string source;
+        for(int i = 0; i < 16; i++)
+            source += "var a" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+        
+        for(int i = 0; i < 16; i++)
+            source += "v[1] += a" + std::to_string(i) + ";\n";
+        
+        const CompiledProgram program = compile(source);
+        REQUIRE(program.error.empty());
+        
+        // v0 goes to spilling, which leaves 13 registers
+        REQUIRE(program.rom.size() > 3);
+        CHECK(program.rom[program.rom.size() - 3] == 13);
+        CHECK(program.rom[program.rom.size() - 2] == 14);
+        CHECK(program.rom[program.rom.size() - 1] == 15);
+        
+        machine.load_rom(program.rom.data(), program.rom.size());
+        machine.run((program.rom.size() - 3) / 2);
+        
+        CHECK(machine.state.v[1] == 120);
+        
+        CHECK(!compile("v[0] = 1;\n" + source).error.empty());
+    }
+    
+    SUBCASE("Reports the first error and its line") {
+        CompiledProgram program = compile("var a = 1;\nb += 2;\n");
+        CHECK(program.error == "unknown variable 'b'");
+        CHECK(program.error_line == 2);
+        
+        program = compile("v[1] = 1\nv[2] = 2;");
+        CHECK(program.error == "expected ';' but found 'v'");
+        CHECK(program.error_line == 2);
+        
+        program = compile("v[1] = 256;");
+        CHECK(program.error == "256 doesn't fit in a byte");
+        
+        program = compile("v[16] = 1;");
+        CHECK(program.error_line == 1);
+        
+        program = compile("label(a);\n\njump(b);");
+        CHECK(program.error == "unknown label 'b'");
+        CHECK(program.error_line == 3);
+        
+        program = compile("jump(end);\nvar a = 5;\nlabel(end);\nv[1] = a;");
+        CHECK(program.error == "jump(end) skips the declaration of 'a'");
+        CHECK(program.error_line == 1);
+        
+        // fine once nothing after the label uses it
+        CHECK(compile("jump(end);\nvar a = 5;\nv[1] = a;\nlabel(end);").error.empty());
+        
+        program = compile("draw_char(1, 2);");
+        CHECK(!program.error.empty());
+        CHECK(program.rom.empty());
+        
+        // two bytes a statement, the one after the program area is full is too many
+        std::string too_big;
+        for(int i = 0; i <= max_rom_size / 2; i++)
+            too_big += "v[1] = 1;\n";
+        
+        program = compile(too_big);
+        CHECK(program.error_line == max_rom_size / 2 + 1);
+    }
+}
+
+TEST_CASE("Loading roms") {
+    const auto directory = std::filesystem::temp_directory_path() / "chip8-test-load";
+    std::filesystem::create_directories(directory);
+    
+    Machine machine;
+    
+    SUBCASE("Fills the program area") {
+        std::vector<uint8_t> rom(max_rom_size, 0x12);
+        write_file(directory / "full.ch8", rom);
+        
+        CHECK(machine.load_rom((directory / "full.ch8").c_str()));
+        CHECK(machine.state.memory[4095] == 0x12);
+    }
+    
+    SUBCASE("Refuses roms bigger than the program area") {
+        std::vector<uint8_t> rom(max_rom_size + 1, 0x12);
+        write_file(directory / "big.ch8", rom);
+        
+        CHECK(!machine.load_rom((directory / "big.ch8").c_str()));
+        CHECK(machine.state.memory[program_begin] == 0);
+    }
+    
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("ROM catalog") {
+    const auto directory = std::filesystem::temp_directory_path() / "chip8-test-catalog";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "schip");
+    
+    const std::vector<uint8_t> chip8 = {0x00, 0xE0, 0x12, 0x02};
+    const std::vector<uint8_t> schip = {0x00, 0xFF, 0x12, 0x02};
+    
+    write_file(directory / "a.ch8", chip8);
+    write_file(directory / "schip" / "b.ch8", schip);
+    write_file(directory / "too-big.ch8", std::vector<uint8_t>(max_rom_size + 1));
+    
+    {
+        RomCatalog catalog;
+        catalog.open(directory.string());
+        catalog.wait();
+        
+        const auto roms = catalog.entries();
+        REQUIRE(roms.size() == 2);
+        
+        CHECK(roms[0].path == (directory / "a.ch8").string());
+        CHECK(roms[0].size == 4);
+        CHECK(roms[0].hash == hash_rom(chip8.data(), chip8.size()));
+        CHECK(roms[0].platform == Platform::CHIP8);
+        CHECK(roms[0].emulate_original);
+        CHECK(roms[1].platform == Platform::SCHIP);
+        CHECK(!roms[1].emulate_original);
+        
+        EmuOptions options;
+        options.emulate_original = false;
+        options.enable_anti_flicker = false;
+        catalog.set_quirks(roms[0].path, options);
+    }
+    
+    SUBCASE("Keeps quirks and hashes in the index") {
+        RomCatalog catalog;
+        catalog.open(directory.string());
+        catalog.wait();
+        
+        const auto roms = catalog.entries();
+        REQUIRE(roms.size() == 2);
+        
+        EmuOptions options;
+        apply_quirks(roms[0], options);
+        CHECK(!options.emulate_original);
+        CHECK(!options.enable_anti_flicker);
+    }
     
-    state.memory[state.I] = 0x1;
-    state.memory[state.I + 1] = 0x2;
-    state.memory[state.I + 2] = 0x3;
+    SUBCASE("Hashes roms again once they change") {
+        const std::vector<uint8_t> changed = {0x00, 0xE0, 0x12, 0x02, 0x00, 0xFE};
+        write_file(directory / "a.ch8", changed);
+        
+        RomCatalog catalog;
+        catalog.open(directory.string());
+        catalog.wait();
+        
+        const auto roms = catalog.entries();
+        REQUIRE(roms.size() == 2);
+        CHECK(roms[0].hash == hash_rom(changed.data(), changed.size()));
+        CHECK(roms[0].platform == Platform::SCHIP);
+        
+        // it's a different rom now, so it's back to the quirks for its platform
+        CHECK(!roms[0].emulate_original);
+        CHECK(roms[0].enable_anti_flicker);
+    }
+    
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("ROM packs") {
+    const auto directory = std::filesystem::temp_directory_path() / "chip8-test-pack";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "roms" / "games");
+    
+    const std::vector<uint8_t> b = {0x00, 0xE0, 0x12, 0x02};
+    const std::vector<uint8_t> a = {0x60, 0x05, 0x12, 0x02, 0xFF};
+    
+    write_file(directory / "roms" / "b.ch8", b);
+    write_file(directory / "roms" / "games" / "a.ch8", a);
+    write_file(directory / "roms" / "too-big.ch8", std::vector<uint8_t>(max_rom_size + 1));
+    
+    const std::string path = (directory / "roms.ch8pack").string();
+    REQUIRE(build_rom_pack((directory / "roms").c_str(), path.c_str()) == 2);
+    
+    RomPack pack;
+    REQUIRE(pack.open(path.c_str()));
+    REQUIRE(pack.size() == 2);
+    
+    SUBCASE("Sorted by name") {
+        CHECK(pack.entry(0).name == "b.ch8");
+        CHECK(pack.entry(1).name == "games/a.ch8");
+    }
+    
+    SUBCASE("Finds and loads roms") {
+        PackEntry entry;
+        REQUIRE(pack.find("games/a.ch8", entry));
+        CHECK(entry.size == a.size());
+        CHECK(entry.hash == hash_rom(a.data(), a.size()));
+        
+        Machine machine;
+        REQUIRE(machine.load_rom(entry.data, entry.size));
+        CHECK(std::equal(a.begin(), a.end(), &machine.state.memory[program_begin]));
+        
+        CHECK(!pack.find("missing.ch8", entry));
+    }
+    
+    SUBCASE("Refuses truncated packs") {
+        pack.close();
+        
+        std::filesystem::resize_file(path, 40);
+        CHECK(!pack.open(path.c_str()));
+    }
+    
+    std::filesystem::remove_all(directory);
+}
 
-    process_opcode(0xF265);
+TEST_CASE("Unimplemented opcodes are counted") {
+    Machine machine;
+    machine.reset();
     
-    CHECK(state.v[0] == 0x1);
-    CHECK(state.v[1] == 0x2);
-    CHECK(state.v[2] == 0x3);
-    CHECK(state.PC == 0x202);
+    // 8XY1 has no handler, so this never gets past it
+    const uint8_t program[] = {0x81, 0x21, 0x12, 0x00};
+    memcpy(machine.state.memory + program_begin, program, sizeof(program));
+    machine.flush_decode_cache();
+    
+    machine.run(100);
+    CHECK(machine.unimplemented_opcodes == 100);
+    CHECK(machine.state.PC == program_begin);
+    
+    machine.reset();
+    CHECK(machine.unimplemented_opcodes == 0);
+}
+
+TEST_CASE("Decode cache") {
+    Machine machine;
+    
+    SUBCASE("Matches process_opcode") {
+        machine.reset();
+        
+        // v[1] = 3, v[1] += 4, I = 0x300
+        const uint8_t program[] = {0x61, 0x03, 0x71, 0x04, 0xA3, 0x00};
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        machine.run(3);
+        
+        CHECK(machine.state.v[1] == 7);
+        CHECK(machine.state.I == 0x300);
+        CHECK(machine.state.PC == 0x206);
+    }
+    
+    SUBCASE("Invalidated by FX55") {
+        machine.reset();
+        
+        // v[0] = 0x62, v[1] = 0x77, I = 0x208, store v[0]-v[1] over the next instruction (v[2] = 0)
+        const uint8_t program[] = {0x60, 0x62, 0x61, 0x77, 0xA2, 0x08, 0xF1, 0x55, 0x62, 0x00};
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        // decode the slot at 0x208 before it gets overwritten
+        machine.state.PC = 0x208;
+        machine.step();
+        CHECK(machine.state.v[2] == 0);
+        
+        machine.state.PC = program_begin;
+        machine.run(5);
+        
+        // 0x208 now holds 6277
+        CHECK(machine.state.v[2] == 0x77);
+        CHECK(machine.state.PC == 0x20A);
+    }
+    
+    SUBCASE("Invalidated past the end of memory") {
+        machine.reset();
+        
+        // decode the last slot, then drop a range starting past it
+        machine.state.PC = 0xFFE;
+        machine.step();
+        
+        machine.invalidate_decode_cache(0x1100, 2);
+        machine.invalidate_decode_cache(0xFFF, 16);
+        
+        // v[1] = 5
+        machine.state.memory[program_begin] = 0x61;
+        machine.state.memory[program_begin + 1] = 0x05;
+        machine.invalidate_decode_cache(program_begin, 2);
+        machine.state.PC = program_begin;
+        machine.run(1);
+        CHECK(machine.state.v[1] == 5);
+    }
+}
+
+TEST_CASE("Quirk sets") {
+    Machine machine;
+    machine.reset();
+    
+    CHECK(machine.options.quirks() == quirk_anti_flicker);
+    
+    SUBCASE("Only the COSMAC profile moves I after FX55/FX65") {
+        // I = 0x300, store v[0]-v[2], load them back
+        const uint8_t program[] = {0xA3, 0x00, 0xF2, 0x55, 0xF2, 0x65};
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        machine.run(3);
+        CHECK(machine.state.I == 0x300);
+        
+        // the same machine again, after the options pick another quirk set
+        machine.options.emulate_original = true;
+        CHECK(machine.options.quirks() == (quirk_increment_index | quirk_anti_flicker));
+        
+        machine.state.PC = program_begin;
+        machine.run(3);
+        CHECK(machine.state.I == 0x306);
+    }
+    
+    SUBCASE("Anti-flicker holds the frame back after a collision") {
+        // I = 0x300, draw the same pixel twice
+        const uint8_t program[] = {0xA3, 0x00, 0xD0, 0x11, 0xD0, 0x11};
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.state.memory[0x300] = 0x80;
+        machine.flush_decode_cache();
+        
+        machine.run(3);
+        CHECK(machine.state.v[0xF] == 1);
+        CHECK(!machine.state.draw_dirty);
+        
+        machine.options.enable_anti_flicker = false;
+        
+        machine.state.PC = program_begin;
+        machine.run(3);
+        CHECK(machine.state.v[0xF] == 1);
+        CHECK(machine.state.draw_dirty);
+    }
+}
+
+#ifdef CHIP8_JIT
+TEST_CASE("JIT matches the interpreter") {
+    // counts v[0] down with arithmetic, a subroutine, a sprite draw and a self-modifying store
+    const uint8_t program[] = {
+        0x60, 0x20, // 200: v[0] = 0x20
+        0x61, 0x05, // 202: v[1] = 5
+        0x22, 0x20, // 204: call 0x220
+        0x81, 0x04, // 206: v[1] += v[0]
+        0x82, 0x12, // 208: v[2] &= v[1]
+        0x83, 0x16, // 20A: v[3] >>= 1
+        0x84, 0x15, // 20C: v[4] -= v[1]
+        0xA0, 0x0A, // 20E: I = 0x00A
+        0xD1, 0x25, // 210: draw 5 rows at v[1], v[2]
+        0x70, 0xFF, // 212: v[0] -= 1
+        0x30, 0x00, // 214: skip if v[0] == 0
+        0x12, 0x04, // 216: jump 0x204
+        0x12, 0x18, // 218: jump 0x218
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x83, 0x10, // 220: v[3] = v[1]
+        0x83, 0x03, // 222: v[3] ^= v[0]
+        0xA2, 0x40, // 224: I = 0x240
+        0xF3, 0x33, // 226: store bcd of v[3]
+        0xF2, 0x55, // 228: store v[0]-v[2]
+        0xA2, 0x40, // 22A: I = 0x240
+        0xF2, 0x65, // 22C: load v[0]-v[2]
+        0x00, 0xEE  // 22E: return
+    };
+    
+    auto run_program = [&program](const Engine engine, const uint64_t count) {
+        Machine machine;
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        machine.options.engine = engine;
+        machine.run(count);
+        
+        return machine.state;
+    };
+    
+    for(const uint64_t count : {1, 7, 50, 1000}) {
+        const EmulatorState interpreted = run_program(Engine::Interpreter, count);
+        const EmulatorState jitted = run_program(Engine::JIT, count);
+        
+        CHECK(jitted.PC == interpreted.PC);
+        CHECK(jitted.I == interpreted.I);
+        CHECK(jitted.stack_pointer == interpreted.stack_pointer);
+        CHECK(memcmp(jitted.v, interpreted.v, sizeof(jitted.v)) == 0);
+        CHECK(memcmp(jitted.memory, interpreted.memory, sizeof(jitted.memory)) == 0);
+        CHECK(memcmp(jitted.framebuffer, interpreted.framebuffer, sizeof(jitted.framebuffer)) == 0);
+    }
+}
+
+TEST_CASE("JIT skips, loops and chains like the interpreter") {
+    // skips both ways inside a block, a loop back into it and a jump out to a block at an odd address
+    const uint8_t program[] = {
+        0x60, 0x05, // 200: v[0] = 5
+        0x61, 0x00, // 202: v[1] = 0
+        0xF0, 0x15, // 204: delay timer = v[0]
+        0xF2, 0x07, // 206: v[2] = delay timer
+        0xF0, 0x18, // 208: sound timer = v[0]
+        0x71, 0x01, // 20A: v[1] += 1
+        0xE1, 0xA1, // 20C: skip if key v[1] is up
+        0x72, 0x01, // 20E: v[2] += 1
+        0x91, 0x00, // 210: skip if v[1] != v[0]
+        0x73, 0x10, // 212: v[3] += 0x10
+        0x41, 0x09, // 214: skip if v[1] != 9
+        0x13, 0x01, // 216: jump 0x301
+        0x12, 0x0A, // 218: jump 0x20A
+        0x12, 0x1A  // 21A: jump 0x21A
+    };
+    
+    // 301: v[4] = v[3], jump 0x21A
+    const uint8_t odd[] = {0x84, 0x30, 0x12, 0x1A};
+    
+    auto run_program = [&](const Engine engine, const uint64_t count) {
+        Machine machine;
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        memcpy(machine.state.memory + 0x301, odd, sizeof(odd));
+        machine.flush_decode_cache();
+        
+        machine.state.keys[2] = true;
+        machine.state.keys[5] = true;
+        
+        machine.options.engine = engine;
+        machine.run(count);
+        
+        return machine.state;
+    };
+    
+    for(const uint64_t count : {1, 6, 9, 40, 73, 1000}) {
+        const EmulatorState interpreted = run_program(Engine::Interpreter, count);
+        const EmulatorState jitted = run_program(Engine::JIT, count);
+        
+        CHECK(jitted.PC == interpreted.PC);
+        CHECK(jitted.delay_timer == interpreted.delay_timer);
+        CHECK(jitted.sound_timer == interpreted.sound_timer);
+        CHECK(memcmp(jitted.v, interpreted.v, sizeof(jitted.v)) == 0);
+    }
+    
+    CHECK(run_program(Engine::JIT, 1000).v[4] == 0x10);
+}
+#endif
+
+TEST_CASE("Superinstruction fusion") {
+    // every fused idiom, looped so that both sides of the skips are taken
+    const uint8_t program[] = {
+        0x60, 0x03, // 200: v[0] = 3
+        0x61, 0x08, // 202: v[1] = 8
+        0xA0, 0x00, // 204: I = 0x000
+        0xD0, 0x15, // 206: draw 5 rows at v[0], v[1]
+        0x70, 0x01, // 208: v[0] += 1
+        0x40, 0x06, // 20A: skip if v[0] != 6
+        0x12, 0x10, // 20C: jump 0x210
+        0x12, 0x04, // 20E: jump 0x204
+        0xF2, 0x07, // 210: v[2] = delay timer
+        0x32, 0x00, // 212: skip if v[2] == 0
+        0x12, 0x10, // 214: jump 0x210
+        0x12, 0x00  // 216: jump 0x200
+    };
+    
+    Machine machine;
+    
+    auto load_program = [&program, &machine] {
+        machine.reset();
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        machine.state.delay_timer = 2;
+    };
+    
+    for(const uint64_t count : {1, 2, 3, 10, 23, 200}) {
+        load_program();
+        for(uint64_t i = 0; i < count; i++) {
+            machine.process_opcode(machine.fetch_opcode(machine.state.PC));
+            
+            // give the timer poll something to wait on
+            if(i == 15)
+                machine.state.delay_timer = 0;
+        }
+        
+        const EmulatorState expected = machine.state;
+        
+        load_program();
+        machine.run(std::min<uint64_t>(count, 16));
+        machine.state.delay_timer = count > 16 ? 0 : machine.state.delay_timer;
+        if(count > 16)
+            machine.run(count - 16);
+        
+        CHECK(machine.state.PC == expected.PC);
+        CHECK(machine.state.I == expected.I);
+        CHECK(memcmp(machine.state.v, expected.v, sizeof(machine.state.v)) == 0);
+        CHECK(memcmp(machine.state.framebuffer, expected.framebuffer, sizeof(machine.state.framebuffer)) == 0);
+    }
+    
+    SUBCASE("Split up by writes") {
+        load_program();
+        
+        // turn the jump at 0x20C into v[0] = 0x10, which breaks up the 4XNN + 1NNN pair
+        machine.state.memory[0x20C] = 0x60;
+        machine.state.memory[0x20D] = 0x10;
+        machine.invalidate_decode_cache(0x20C, 2);
+        
+        machine.state.PC = 0x20A;
+        machine.state.v[0] = 6;
+        machine.run(2);
+        
+        CHECK(machine.state.v[0] == 0x10);
+        CHECK(machine.state.PC == 0x20E);
+    }
+}
+
+TEST_CASE("Machines are independent") {
+    // v[0] = 1, I = 0x300, store v[0] to 0x300
+    const uint8_t program[] = {0x60, 0x01, 0xA3, 0x00, 0xF0, 0x55};
+    
+    Machine first, second;
+    memcpy(first.state.memory + program_begin, program, sizeof(program));
+    first.flush_decode_cache();
+    
+    first.run(3);
+    
+    CHECK(first.state.v[0] == 1);
+    CHECK(first.state.memory[0x300] == 1);
+    CHECK(second.state.v[0] == 0);
+    CHECK(second.state.memory[0x300] == 0);
+    CHECK(second.state.PC == program_begin);
+}
+
+TEST_CASE("CXNN is seeded per machine") {
+    // v[0] = random & 0xFF, twice
+    const uint8_t program[] = {0xC0, 0xFF, 0xC1, 0xFF};
+    
+    auto run_program = [&program](const uint32_t seed) {
+        Machine machine;
+        machine.seed = seed;
+        machine.reset();
+        memcpy(machine.state.memory + program_begin, program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        machine.run(2);
+        
+        return (machine.state.v[0] << 8) | machine.state.v[1];
+    };
+    
+    CHECK(run_program(1) == run_program(1));
+    CHECK(run_program(1) != run_program(2));
+}
+
+#ifdef CHIP8_LOCKSTEP
+TEST_CASE("Lockstep matches Machine") {
+    // branches on keys, so lanes with different inputs split up and join back together at 0x204
+    const uint8_t program[] = {
+        0x60, 0x00, // 200: v[0] = 0
+        0x61, 0x05, // 202: v[1] = 5
+        0xE0, 0x9E, // 204: skip if key v[0] is down
+        0x12, 0x0C, // 206: jump 0x20C
+        0x71, 0x03, // 208: v[1] += 3
+        0x22, 0x30, // 20A: call 0x230
+        0x70, 0x01, // 20C: v[0] += 1
+        0x62, 0x0F, // 20E: v[2] = 0xF
+        0x80, 0x22, // 210: v[0] &= v[2]
+        0xC3, 0xFF, // 212: v[3] = random
+        0x83, 0x14, // 214: v[3] += v[1]
+        0xF0, 0x29, // 216: I = font character v[0]
+        0xD1, 0x35, // 218: draw 5 rows at v[1], v[3]
+        0xF3, 0x33, // 21A: store bcd of v[3] over the font
+        0x12, 0x04, // 21C: jump 0x204
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0x00, 0x00,
+        0xA3, 0x00, // 230: I = 0x300
+        0xF3, 0x55, // 232: store v[0]-v[3]
+        0xF3, 0x65, // 234: load v[0]-v[3]
+        0xF1, 0x1E, // 236: I += v[1]
+        0x81, 0x06, // 238: v[1] >>= 1
+        0x00, 0xEE  // 23A: return
+    };
+    
+    Machine loader;
+    loader.reset();
+    memcpy(loader.state.memory + program_begin, program, sizeof(program));
+    
+    auto key_down = [](const int lane, const int key) {
+        return (lane * 7 + key) % 5 == 0;
+    };
+    
+    constexpr int lanes = 37;
+    
+    Lockstep lockstep(lanes);
+    for(int lane = 0; lane < lanes; lane++) {
+        lockstep.set_lane(lane, loader.state);
+        
+        for(int key = 0; key < 16; key++)
+            lockstep.set_key(lane, key, key_down(lane, key));
+    }
+    
+    for(int frame = 0; frame < 40; frame++) {
+        lockstep.tick_timers();
+        lockstep.run(13);
+    }
+    
+    CHECK(lockstep.divergent_steps > 0);
+    
+    for(int lane = 0; lane < lanes; lane++) {
+        Machine machine;
+        machine.state = loader.state;
+        machine.flush_decode_cache();
+        
+        for(int key = 0; key < 16; key++)
+            machine.state.keys[key] = key_down(lane, key);
+        
+        for(int frame = 0; frame < 40; frame++) {
+            machine.tick_timers();
+            machine.run(13);
+        }
+        
+        const EmulatorState result = lockstep.get_lane(lane);
+        
+        CHECK(result.PC == machine.state.PC);
+        CHECK(result.I == machine.state.I);
+        CHECK(result.stack_pointer == machine.state.stack_pointer);
+        CHECK(memcmp(result.v, machine.state.v, sizeof(result.v)) == 0);
+        CHECK(memcmp(result.memory, machine.state.memory, sizeof(result.memory)) == 0);
+        CHECK(memcmp(result.framebuffer, machine.state.framebuffer, sizeof(result.framebuffer)) == 0);
+    }
+    
+    SUBCASE("Stays converged with the same inputs") {
+        Lockstep together(lanes);
+        for(int lane = 0; lane < lanes; lane++)
+            together.set_lane(lane, loader.state);
+        
+        together.run(500);
+        
+        CHECK(together.divergent_steps == 0);
+        CHECK(together.converged_steps == 500);
+    }
+}
+
+TEST_CASE("Lockstep matches Machine in hires") {
+    // lanes with key 0 down go back to low resolution, the rest stay in hires
+    const uint8_t program[] = {
+        0x00, 0xFF, // 200: hires
+        0x60, 0x00, // 202: v[0] = 0
+        0xE0, 0x9E, // 204: skip if key v[0] is down
+        0x12, 0x0A, // 206: jump 0x20A
+        0x00, 0xFE, // 208: lores
+        0xC2, 0x7F, // 20A: v[2] = random
+        0xA0, 0x00, // 20C: I = 0
+        0xD1, 0x20, // 20E: draw 16x16 at v[1], v[2]
+        0xD1, 0x25, // 210: draw 5 rows at v[1], v[2]
+        0x00, 0xC3, // 212: scroll down 3
+        0x00, 0xFB, // 214: scroll right
+        0x71, 0x05, // 216: v[1] += 5
+        0x00, 0xFC, // 218: scroll left
+        0xD1, 0x20, // 21A: draw 16x16 at v[1], v[2]
+        0x12, 0x0A  // 21C: jump 0x20A
+    };
+    
+    Machine loader;
+    loader.reset();
+    memcpy(loader.state.memory + program_begin, program, sizeof(program));
+    
+    constexpr int lanes = 37;
+    
+    for(const bool mixed : {true, false}) {
+        auto key_down = [&](const int lane) {
+            return mixed && lane % 3 == 0;
+        };
+        
+        Lockstep lockstep(lanes);
+        for(int lane = 0; lane < lanes; lane++) {
+            lockstep.set_lane(lane, loader.state);
+            lockstep.set_key(lane, 0, key_down(lane));
+        }
+        
+        lockstep.run(300);
+        
+        for(int lane = 0; lane < lanes; lane++) {
+            Machine machine;
+            machine.state = loader.state;
+            machine.state.keys[0] = key_down(lane);
+            machine.flush_decode_cache();
+            
+            machine.run(300);
+            
+            const EmulatorState result = lockstep.get_lane(lane);
+            
+            CHECK(result.PC == machine.state.PC);
+            CHECK(result.hires == machine.state.hires);
+            CHECK(memcmp(result.v, machine.state.v, sizeof(result.v)) == 0);
+            CHECK(memcmp(result.framebuffer, machine.state.framebuffer, sizeof(result.framebuffer)) == 0);
+        }
+    }
+}
+#endif
+
+TEST_CASE("Scheduler") {
+    Machine machine;
+    
+    // jump 0x200 forever
+    machine.state.memory[0x200] = 0x12;
+    machine.state.memory[0x201] = 0x00;
+    machine.flush_decode_cache();
+    
+    machine.state.delay_timer = 100;
+    machine.state.sound_timer = 100;
+    
+    const auto start = Scheduler::clock::now();
+    
+    Scheduler scheduler;
+    scheduler.instructions_per_second = 650;
+    scheduler.max_catch_up_ticks = 120;
+    scheduler.restart(start);
+    
+    SUBCASE("Runs at the set rate") {
+        uint64_t executed = 0;
+        
+        // called at an uneven rate, like a busy ui thread would
+        for(int ms = 0; ms <= 1000; ms += 7)
+            executed += scheduler.advance(machine, start + std::chrono::milliseconds(ms));
+        
+        executed += scheduler.advance(machine, start + std::chrono::seconds(1));
+        
+        CHECK(executed == 650);
+        CHECK(scheduler.ticks == 60);
+        CHECK(machine.state.delay_timer == 40);
+        CHECK(machine.state.sound_timer == 40);
+    }
+    
+    SUBCASE("Drops ticks when too far behind") {
+        const uint64_t executed = scheduler.advance(machine, start + std::chrono::seconds(10));
+        
+        CHECK(scheduler.ticks == 120);
+        CHECK(scheduler.dropped_ticks == 480);
+        CHECK(executed == 1300);
+        
+        // and carries on at the normal rate after that
+        scheduler.advance(machine, start + std::chrono::seconds(11));
+        CHECK(scheduler.ticks == 180);
+    }
+    
+    SUBCASE("Knows when the next tick is due") {
+        scheduler.advance(machine, scheduler.next_tick() - std::chrono::nanoseconds(1));
+        CHECK(scheduler.ticks == 0);
+        
+        scheduler.advance(machine, scheduler.next_tick());
+        CHECK(scheduler.ticks == 1);
+    }
+}
+
+TEST_CASE("Scheduler applies input") {
+    Machine machine;
+    
+    // count loops in V1 until key 5 is down, then stop
+    constexpr uint8_t program[] = {
+        0x71, 0x01, // ADD V1, 1
+        0xE5, 0x9E, // SKP V5
+        0x12, 0x00, // JP 0x200
+        0x12, 0x06  // JP 0x206
+    };
+    std::memcpy(&machine.state.memory[0x200], program, sizeof(program));
+    machine.state.v[5] = 5;
+    machine.flush_decode_cache();
+    
+    const auto start = Scheduler::clock::now();
+    
+    // 10 instructions per tick
+    Scheduler scheduler;
+    scheduler.instructions_per_second = 600;
+    scheduler.restart(start);
+    
+    // rounded up, so whole ticks are due at multiples of it
+    const auto tick = std::chrono::nanoseconds(1'000'000'000 / 60 + 1);
+    
+    InputQueue input;
+    
+    SUBCASE("At the instruction it happened during") {
+        // lands on the 6th instruction of the first tick, after the second loop's SKP
+        input.push({start + tick * 3 / 5, 5, true});
+        
+        scheduler.advance(machine, start + tick * 2, &input);
+        
+        CHECK(input.size() == 0);
+        CHECK(machine.state.keys[5]);
+        CHECK(machine.state.v[1] == 3);
+        CHECK(machine.state.PC == 0x206);
+    }
+    
+    SUBCASE("Not before its tick runs") {
+        input.push({start + tick * 3 / 2, 5, true});
+        
+        scheduler.advance(machine, start + tick, &input);
+        CHECK(input.size() == 1);
+        CHECK(!machine.state.keys[5]);
+        
+        scheduler.advance(machine, start + tick * 2, &input);
+        CHECK(input.size() == 0);
+        CHECK(machine.state.PC == 0x206);
+    }
+    
+    SUBCASE("Applied straight away while not running") {
+        input.push({start, 5, true});
+        input.push({start + tick, 5, false});
+        
+        apply_input(machine, input, start + tick / 2);
+        CHECK(machine.state.keys[5]);
+        CHECK(input.size() == 1);
+    }
+}
+
+TEST_CASE("Beeper") {
+    Beeper beeper(6000);
+    beeper.start_queued = 0;
+    beeper.max_queued = UINT64_MAX;
+    
+    std::vector<int16_t> samples(100);
+    
+    SUBCASE("Renders the gates") {
+        beeper.gate(true, 20);
+        beeper.gate(false, 50);
+        beeper.flush(100);
+        
+        CHECK(beeper.queued() == 100);
+        
+        beeper.render(samples.data(), 100);
+        
+        CHECK(beeper.queued() == 0);
+        CHECK(std::all_of(samples.begin(), samples.begin() + 20, [](int16_t s) { return s == 0; }));
+        CHECK(std::all_of(samples.begin() + 20, samples.begin() + 50, [&](int16_t s) { return std::abs(s) == beeper.volume; }));
+        CHECK(std::all_of(samples.begin() + 50, samples.end(), [](int16_t s) { return s == 0; }));
+    }
+    
+    SUBCASE("Waits until enough is queued") {
+        beeper.start_queued = 200;
+        
+        beeper.gate(true, 0);
+        beeper.flush(100);
+        beeper.render(samples.data(), 100);
+        CHECK(beeper.queued() == 100);
+        CHECK(samples[50] == 0);
+        
+        beeper.flush(300);
+        beeper.render(samples.data(), 100);
+        CHECK(beeper.queued() == 200);
+        CHECK(samples[50] != 0);
+    }
+    
+    SUBCASE("Follows sound_timer at instruction resolution") {
+        Machine machine;
+        
+        constexpr uint8_t program[] = {
+            0x60, 0x05, // LD V0, 5
+            0xF0, 0x18, // LD ST, V0
+            0x12, 0x04  // JP 0x204
+        };
+        std::memcpy(&machine.state.memory[0x200], program, sizeof(program));
+        machine.flush_decode_cache();
+        
+        // 10 instructions and 100 samples per tick
+        const auto start = Scheduler::clock::now();
+        
+        Scheduler scheduler;
+        scheduler.instructions_per_second = 600;
+        scheduler.restart(start);
+        scheduler.advance(machine, start + std::chrono::milliseconds(100), nullptr, &beeper);
+        
+        samples.resize(beeper.queued());
+        beeper.render(samples.data(), samples.size());
+        
+        // on from the end of FX18 to the end of the 5th tick
+        REQUIRE(samples.size() == 600);
+        CHECK(samples[19] == 0);
+        CHECK(samples[20] != 0);
+        CHECK(samples[499] != 0);
+        CHECK(samples[500] == 0);
+    }
+    
+    SUBCASE("Runs a span with an FX18 again from where it started") {
+        constexpr uint8_t program[] = {
+            0xA3, 0x00, // LD I, 0x300
+            0x60, 0x05, // LD V0, 5
+            0xF0, 0x33, // LD B, V0
+            0x70, 0x01, // ADD V0, 1
+            0xF0, 0x18, // LD ST, V0
+            0x12, 0x0A  // JP 0x20A
+        };
+        
+        for(const Engine engine : {Engine::Interpreter, Engine::JIT}) {
+            Beeper beeper(6000);
+            beeper.start_queued = 0;
+            beeper.max_queued = UINT64_MAX;
+            
+            Machine beeping, silent;
+            for(Machine* machine : {&beeping, &silent}) {
+                std::memcpy(&machine->state.memory[0x200], program, sizeof(program));
+                machine->flush_decode_cache();
+                machine->options.engine = engine;
+            }
+            
+            beeping.run(1);
+            beeper.run(beeping, 9, 10, 100);
+            beeper.flush(100);
+            silent.run(10);
+            
+            CHECK(beeping.state.PC == silent.state.PC);
+            CHECK(beeping.state.sound_timer == 6);
+            CHECK(beeping.sound_timer_writes == 1);
+            CHECK(std::memcmp(beeping.state.memory, silent.state.memory, sizeof(silent.state.memory)) == 0);
+            
+            // FX18 is the 4th of the 9 instructions
+            samples.resize(beeper.queued());
+            beeper.render(samples.data(), samples.size());
+            
+            REQUIRE(samples.size() == 100);
+            CHECK(samples[49] == 0);
+            CHECK(samples[50] != 0);
+        }
+    }
+}
+
+TEST_CASE("SPSC ring") {
+    SpscRing<int, 4> ring;
+    
+    SUBCASE("Fills up and empties in order") {
+        CHECK(ring.peek() == nullptr);
+        
+        for(int i = 0; i < 4; i++)
+            CHECK(ring.push(i));
+        
+        CHECK(!ring.push(4));
+        
+        for(int i = 0; i < 4; i++) {
+            REQUIRE(ring.peek() != nullptr);
+            CHECK(*ring.peek() == i);
+            ring.pop();
+        }
+        
+        CHECK(ring.peek() == nullptr);
+    }
+    
+    SUBCASE("Keeps order across threads") {
+        constexpr int count = 200000;
+        
+        std::thread producer([&] {
+            for(int i = 0; i < count; i++) {
+                while(!ring.push(i))
+                    std::this_thread::yield();
+            }
+        });
+        
+        int expected = 0;
+        bool in_order = true;
+        while(expected < count) {
+            if(const int* value = ring.peek()) {
+                in_order &= *value == expected++;
+                ring.pop();
+            }
+        }
+        
+        producer.join();
+        
+        CHECK(in_order);
+    }
+}
+
+TEST_CASE("Triple buffer") {
+    TripleBuffer<uint64_t> buffer;
+    
+    SUBCASE("Reads the newest published value") {
+        CHECK(!buffer.update());
+        
+        buffer.write_buffer() = 1;
+        buffer.publish();
+        buffer.write_buffer() = 2;
+        buffer.publish();
+        
+        CHECK(buffer.update());
+        CHECK(buffer.read_buffer() == 2);
+        CHECK(!buffer.update());
+        CHECK(buffer.read_buffer() == 2);
+    }
+    
+    SUBCASE("Never goes backwards across threads") {
+        constexpr uint64_t count = 200000;
+        
+        std::thread writer([&] {
+            for(uint64_t i = 1; i <= count; i++) {
+                buffer.write_buffer() = i;
+                buffer.publish();
+            }
+        });
+        
+        uint64_t last = 0;
+        bool in_order = true;
+        while(last != count) {
+            if(buffer.update()) {
+                in_order &= buffer.read_buffer() > last;
+                last = buffer.read_buffer();
+            }
+        }
+        
+        writer.join();
+        
+        CHECK(in_order);
+    }
 }